@@ -0,0 +1,283 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include <sched.h>
+
+/*
+	CgroupCpu
+
+	이 프로세스가 실제로 쓸 수 있는 CPU 수를 cgroup v2와 affinity에서 읽는다.
+
+		cpu.max			CFS quota / period ( 조상 cgroup들 중 가장 작은 값 )
+		cpuset.cpus.effective	쓸 수 있는 CPU 목록
+		sched_getaffinity	이 쓰레드의 affinity
+
+	컨테이너가 quota로 4 CPU만 받았는데 std::thread::hardware_concurrency()대로
+	worker를 만들면 quota를 다 쓰고 throttle되어 지연이 튄다.
+	cgroup v2의 마운트 위치는 /proc/self/mountinfo에서, 자기 cgroup은 /proc/self/cgroup에서 찾는다.
+*/
+class CgroupCpu{
+public:
+	/*
+		CgroupCpu
+
+		/proc에서 cgroup v2 마운트와 이 프로세스의 cgroup을 찾는다.
+		찾지 못하면 affinity만 쓴다.
+	*/
+	CgroupCpu(){
+		std::string root;
+
+		if( findMount( &mountPoint, &root ) && findCgroup( &path ) ){
+			// cgroup namespace 밖에서 마운트된 부분 트리면 그 앞부분을 뗀다.
+			if( root != "/" && path.compare( 0, root.size(), root ) == 0 )
+				path = path.substr( root.size() );
+		}
+		else
+			mountPoint.clear();
+	}
+	/*
+		CgroupCpu
+
+		_mountPoint : cgroup v2가 마운트된 디렉토리
+		_path : 마운트 아래에서 이 프로세스의 cgroup 경로 ( "/a/b" )
+	*/
+	CgroupCpu(const std::string &_mountPoint, const std::string &_path) :
+		mountPoint( _mountPoint ), path( _path ) {
+	}
+
+	/*
+		quotaCpus
+
+		cpu.max로 정해진 CPU 수 ( quota / period, 제한이 없으면 0 )
+	*/
+	double quotaCpus() const{
+		if( mountPoint.empty() )
+			return 0;
+
+		double quota = 0;
+		std::string current = path;
+
+		// 자기부터 마운트 루트까지 올라가며 가장 작은 quota를 쓴다.
+		while( true ){
+			char buffer[128];
+
+			if( readLine( mountPoint + current + "/cpu.max", buffer, sizeof(buffer) ) ){
+				char limit[64];
+				unsigned long long period = 0;
+
+				if( sscanf( buffer, "%63s %llu", limit, &period ) == 2 &&
+					strcmp( limit, "max" ) != 0 && period > 0 ){
+					double cpus = strtod( limit, nullptr ) / (double)period;
+					if( quota == 0 || cpus < quota )
+						quota = cpus;
+				}
+			}
+
+			if( current.empty() || current == "/" )
+				break;
+			current = current.substr( 0, current.find_last_of( '/' ) );
+		}
+		return quota;
+	}
+
+	/*
+		cpusetCpus
+
+		cpuset.cpus.effective의 CPU 수 ( 읽을 수 없으면 0 )
+	*/
+	int cpusetCpus() const{
+		char buffer[4096];
+
+		if( mountPoint.empty() ||
+			!readLine( mountPoint + path + "/cpuset.cpus.effective", buffer, sizeof(buffer) ) )
+			return 0;
+
+		return countCpuList( buffer );
+	}
+
+	/*
+		affinityCpus
+
+		이 쓰레드의 affinity에 든 CPU 수 ( 읽을 수 없으면 hardware_concurrency )
+	*/
+	static int affinityCpus(){
+		cpu_set_t set;
+
+		CPU_ZERO( &set );
+		if( sched_getaffinity( 0, sizeof(set), &set ) == 0 )
+			return CPU_COUNT( &set );
+
+		return (int)std::thread::hardware_concurrency();
+	}
+
+	/*
+		cpus
+
+		quota( 내림 ), cpuset, affinity 중 가장 작은 값 ( 최소 1 )
+	*/
+	int cpus() const{
+		int count = affinityCpus();
+
+		int cpuset = cpusetCpus();
+		if( cpuset > 0 )
+			count = std::min( count, cpuset );
+
+		double quota = quotaCpus();
+		if( quota > 0 )
+			count = std::min( count, (int)quota );
+
+		return std::max( count, 1 );
+	}
+
+	/*
+		countCpuList
+
+		"0-3,6,8-9" 형태의 CPU 목록에 든 CPU 수
+	*/
+	static int countCpuList(const char *list){
+		int count = 0;
+		const char *p = list;
+
+		while( *p != '\0' && *p != '\n' ){
+			char *end;
+			long first = strtol( p, &end, 10 );
+			long last = first;
+
+			if( end == p )
+				break;
+			if( *end == '-' ){
+				p = end + 1;
+				last = strtol( p, &end, 10 );
+			}
+
+			if( last >= first )
+				count += (int)( last - first + 1 );
+
+			p = end;
+			if( *p == ',' )
+				p ++;
+		}
+		return count;
+	}
+
+protected:
+	static bool readLine(const std::string &file, char *buffer, size_t size){
+		FILE *fp = fopen( file.c_str(), "r" );
+		if( fp == nullptr )
+			return false;
+
+		bool ok = fgets( buffer, (int)size, fp ) != nullptr;
+		fclose( fp );
+		return ok;
+	}
+
+	/*
+		findMount
+
+		/proc/self/mountinfo에서 cgroup2 마운트의 위치와 그 루트를 찾는다.
+	*/
+	static bool findMount(std::string *mount, std::string *root){
+		FILE *fp = fopen( "/proc/self/mountinfo", "r" );
+		if( fp == nullptr )
+			return false;
+
+		char line[4096];
+		bool found = false;
+
+		// id parent major:minor root mountPoint options ... - fstype source superOptions
+		while( !found && fgets( line, sizeof(line), fp ) != nullptr ){
+			const char *separator = strstr( line, " - " );
+			if( separator == nullptr || strncmp( separator + 3, "cgroup2 ", 8 ) != 0 )
+				continue;
+
+			char mountRoot[1024], mountPath[1024];
+			if( sscanf( line, "%*s %*s %*s %1023s %1023s", mountRoot, mountPath ) == 2 ){
+				*root = mountRoot;
+				*mount = mountPath;
+				found = true;
+			}
+		}
+
+		fclose( fp );
+		return found;
+	}
+
+	/*
+		findCgroup
+
+		/proc/self/cgroup에서 cgroup v2의 경로( "0::/a/b" )를 찾는다.
+	*/
+	static bool findCgroup(std::string *cgroup){
+		FILE *fp = fopen( "/proc/self/cgroup", "r" );
+		if( fp == nullptr )
+			return false;
+
+		char line[4096];
+		bool found = false;
+
+		while( !found && fgets( line, sizeof(line), fp ) != nullptr ){
+			if( strncmp( line, "0::", 3 ) != 0 )
+				continue;
+
+			*cgroup = line + 3;
+			while( !cgroup->empty() && ( cgroup->back() == '\n' || cgroup->back() == '/' ) )
+				cgroup->pop_back();
+			found = true;
+		}
+
+		fclose( fp );
+		return found;
+	}
+
+protected:
+	std::string mountPoint;	// cgroup v2 마운트 ( 없으면 비어있음 )
+	std::string path;	// 마운트 아래의 cgroup 경로 ( 루트면 비어있음 )
+};
+
+/*
+	availableCpus
+
+	CgroupCpu::cpus()를 프로세스 전체에서 공유하는 값.
+	refreshInterval마다 다시 읽으므로 실행 중에 quota나 cpuset이 바뀌어도 따라간다.
+	자주 불러도 되며, 다시 읽는 동안 다른 쓰레드는 지난 값을 쓴다.
+*/
+inline int availableCpus(){
+	static constexpr uint64_t refreshInterval = 1000000000;	// ns
+
+	static std::atomic<int> cached( 0 );
+	static std::atomic<uint64_t> refreshedAt( 0 );
+	static std::mutex refreshMutex;
+
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	uint64_t now = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+
+	int cpus = cached.load();
+	if( cpus > 0 && now - refreshedAt.load() < refreshInterval )
+		return cpus;
+
+	std::unique_lock<std::mutex> guard( refreshMutex, std::try_to_lock );
+	if( !guard.owns_lock() ){
+		if( cpus > 0 )
+			return cpus;
+		guard.lock();	// 처음 읽는 중이면 기다린다.
+	}
+
+	if( cached.load() == 0 || now - refreshedAt.load() >= refreshInterval ){
+		cached.store( CgroupCpu().cpus() );
+		refreshedAt.store( now );
+	}
+	return cached.load();
+}
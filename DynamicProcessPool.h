@@ -4,17 +4,75 @@
 
 #include <queue>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <string>
 
 #include <thread>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <type_traits>
 
-template <typename T>
+#include "ScratchArena.h"
+#include "SpillQueue.h"
+#include "PoolJournal.h"
+#include "RecyclePolicy.h"
+#include "IoRing.h"
+#include "LatencySlo.h"
+#include "CgroupCpu.h"
+#include "ThreadGovernor.h"
+
+/*
+	NoWorkerState
+
+	worker별 상태가 필요 없을 때 쓰는 빈 상태 타입
+*/
+struct NoWorkerState{
+};
+
+/*
+	DynamicProcessPool
+
+	T : workItem의 타입
+	H : 핸들러 타입. 기본값은 std::function이며, 함수 객체 타입을 직접 지정하면
+	    type erasure 없이 workthread 안에서 핸들러가 인라인된다.
+	    ( VariantDispatcher.h 참고 )
+
+	S : worker별 상태 타입. worker마다 하나씩 생성되어 worker가 살아있는 동안 유지된다.
+	    ( DB 연결, 컴파일된 regex 캐시 등 )
+
+	핸들러는 아래 형태 중 하나를 가질 수 있다.
+		bool(T)
+		bool(T, ScratchArena&)		worker 전용 ScratchArena를 받는다
+		bool(T, S&)			worker 상태를 받는다
+		bool(T, S&, ScratchArena&)	둘 다 받는다
+		bool(T, IoContext&)		I/O 모드 ( IoRing.h 참고 )
+		bool(T, S&, IoContext&)		I/O 모드에서 worker 상태도 받는다
+
+	I/O 모드에서는 worker마다 io_uring을 하나씩 가지며, 핸들러는 read/write를 걸고
+	바로 반환한다. worker는 I/O가 끝나기를 기다리는 동안 다른 workItem을 처리하므로
+	적은 수의 worker로도 장치를 채울 수 있다. continuation은 그 I/O를 건 worker에서 불린다.
+	저널의 완료 기록과 inflight 바이트는 핸들러가 반환할 때 정리된다. ( continuation이 아니라 )
+	kill이나 소멸자로 종료하면 끝나지 않은 I/O는 취소되고 continuation은 -ECANCELED를 받는다.
+*/
+template <typename T, typename H = std::function<bool(T)>,
+	  typename S = NoWorkerState>
 class DynamicProcessPool{
 public:
-	typedef std::function<bool(T)>	handler_t;
+	typedef H			handler_t;
 	typedef std::thread		worker_t;
+	typedef S			workerState_t;
+	typedef std::function<void(S&)>	workerHook_t;
+	typedef std::function<size_t(const T&)> sizer_t;
+
+	typedef struct{
+		T item;
+		size_t bytes;	// sizer로 잰 workItem의 크기
+		uint64_t journalId;	// 저널 레코드 id ( 저널을 쓰지 않으면 0 )
+		uint64_t enqueuedAt;	// enqueue된 시각 ( ns, 대기 시간 SLO를 쓰지 않으면 0 )
+	} workEntry_t;
 
 	DynamicProcessPool(){
 	}
@@ -29,13 +87,42 @@ public:
 	*/
 	DynamicProcessPool( int _initialWorkers,int _maxWorker,
 			    int _lifeTime, handler_t _handler) :
+		DynamicProcessPool( _initialWorkers, _maxWorker, _lifeTime, _handler,
+				    workerHook_t(), workerHook_t() ) {
+	}
+	/*
+		DynamicProcessPool
+
+		_initialWorkers : 처음에 가지고 시작할 worker의 수
+		_maxWorker : 최대 가질 수 있는 worker의 수
+		_lifeTime : 한 개의 worker가 일을 몇 번 수행할지 횟수
+		_handler : workItem을 핸들링할 핸들러
+		_onWorkerStart : worker가 workItem을 받기 전에 worker 상태를 준비하는 훅
+		_onWorkerStop : worker가 종료될 때 worker 상태를 정리하는 훅
+	*/
+	DynamicProcessPool( int _initialWorkers,int _maxWorker,
+			    int _lifeTime, handler_t _handler,
+			    workerHook_t _onWorkerStart, workerHook_t _onWorkerStop) :
 		handler( _handler ),
+		onWorkerStart( _onWorkerStart ), onWorkerStop( _onWorkerStop ),
 		maxWorker( _maxWorker ), lifeTime( _lifeTime ),
+		arenaChunkSize( 64 * 1024 ), arenaRetainSize( 1024 * 1024 ),
+		arenaResetInterval( 1 ),
 		quit( false ),
-		nWorker( 0 ), nWaiting( 0 ), nWorking( 0 ) {
+		nWorker( 0 ), nWaiting( 0 ), nWorking( 0 ),
+		queuedBytes( 0 ), inflightBytes( 0 ),
+		maxQueuedBytes( 0 ), nBlocked( 0 ), spillThreshold( 0 ), nSpilled( 0 ),
+		recycleVersion( 0 ), ioRingEntries( 256 ), nIoWaiting( 0 ),
+		nBlockingWorkers( 0 ), maxBlockingSpares( _maxWorker ), nExiting( 0 ),
+		sloEnabled( false ), sloWorkers( 0 ), lastQueueWaitP99( 0 ),
+		governor( nullptr ), governorId( -1 ),
+		utilizationCpus( 0 ), cgroupAware( false ), utilization( 0 ), nUtilizationSamples( 0 ),
+		durableEnqueue( false ) {
 
-		for(int i=0;i<_initialWorkers;i++)
+		for(int i=0;i<_initialWorkers;i++){
+			nWorker.fetch_add( 1 );
 			addWorker( _lifeTime );
+		}
 	}
 	/*
 		~DynamicProcessPool
@@ -51,23 +138,84 @@ public:
 
 		work queue에 workItem을 집어넣는다.
 
+		메모리 예산이 설정되어 있으면 대기 중인 workItem의 바이트 합이
+		maxQueuedBytes 아래로 내려갈 때까지 블록된다.
+		spill이 켜져 있으면 블록되는 대신 디스크에 쌓는다.
+		저널이 켜져 있으면 큐에 넣기 전에 로그에 먼저 기록한다.
+
 		workItem : 넣을 workItem
 	*/
 	void enqueue(T workItem){
-		// 비어있는 worker가 없고 maxWorker만큼 worker가 없으면
-		// 새 worker를 생성하고 일을 할당.
-		if( maxWorker < nWorker.load() && nWaiting.load() == 0 ){
-			addWorkerWithWork( lifeTime, workItem );
+		workEntry_t entry;
+
+		entry.bytes = sizer ? sizer( workItem ) : 0;
+		entry.journalId = 0;
+		entry.enqueuedAt = enqueueStamp();
+
+		if constexpr( PoolCodec<T>::supported ){
+			if( journal != nullptr ){
+				entry.journalId = journal->append( workItem );
+				if( durableEnqueue )
+					journal->waitDurable( entry.journalId );
+			}
 		}
-		else{
-			std::unique_lock<std::mutex> guard( queueMutex );
-				qWork.push( workItem );
+
+		entry.item = std::move( workItem );
+		dispatch( std::move(entry) );
+	}
+
+	/*
+		enqueueBulk
+
+		여러 workItem을 한 번의 락으로 work queue에 넣고,
+		기다리는 worker를 깨운 뒤 모자라면 maxWorker까지 worker를 만든다.
+		저널, spill, 메모리 예산이 켜져 있으면 workItem마다 enqueue와 같은 규칙을 따른다.
+
+		workItems : 넣을 workItem들
+	*/
+	void enqueueBulk(std::vector<T> workItems){
+		size_t count = workItems.size();
+		if( count == 0 )
+			return;
+
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		if( journal != nullptr || spill != nullptr || maxQueuedBytes > 0 ){
 			guard.unlock();
 
-			// signal을 기다리는 worker가 있을 때만 notify
-			if( nWaiting.load() > 0 )
+			for( auto &workItem : workItems )
+				enqueue( std::move(workItem) );
+			return;
+		}
+
+		uint64_t stamp = enqueueStamp();
+		for( auto &workItem : workItems ){
+			workEntry_t entry;
+
+			entry.bytes = sizer ? sizer( workItem ) : 0;
+			entry.journalId = 0;
+			entry.enqueuedAt = stamp;
+			entry.item = std::move( workItem );
+
+			queuedBytes.fetch_add( entry.bytes );
+			qWork.push( std::move(entry) );
+		}
+		guard.unlock();
+
+		size_t waiting = (size_t)nWaiting.load();
+		if( waiting >= count ){
+			for( size_t i=0;i<count;i++ )
 				signal.notify_one();
 		}
+		else{
+			if( waiting > 0 )
+				signal.notify_all();
+
+			// 대기 시간 SLO를 쓰면 worker 수는 조절기가 정한다.
+			for( size_t i=waiting;i<count && !sloEnabled.load() && reserveWorker();i++ )
+				addWorker( lifeTime );
+		}
+		wakeIoWaiters();
 	}
 
 	/*
@@ -79,10 +227,384 @@ public:
 		working : working중인 worker의 수를 받아올 포인터
 	*/
 	void queryPoolStatus(int *waiting,int *working){
+		queryPoolStatus( waiting, working, nullptr, nullptr );
+	}
+	/*
+		queryPoolStatus
+
+		풀의 상태를 얻어온다.
+
+		waiting : waiting중인 worker의 수를 받아올 포인터
+		working : working중인 worker의 수를 받아올 포인터
+		queued : 큐에서 대기 중인 workItem의 바이트 합을 받아올 포인터
+		inflight : 핸들러가 처리 중인 workItem의 바이트 합을 받아올 포인터
+	*/
+	void queryPoolStatus(int *waiting,int *working,
+			     size_t *queued,size_t *inflight){
 		if( waiting != nullptr )
 			*waiting = nWaiting.load();
 		if( working != nullptr )
 			*working = nWorking.load();
+		if( queued != nullptr )
+			*queued = queuedBytes.load();
+		if( inflight != nullptr )
+			*inflight = inflightBytes.load();
+	}
+
+	/*
+		queryQueueDepth
+
+		큐( spill 포함 )에서 대기 중인 workItem의 수
+	*/
+	size_t queryQueueDepth(){
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		return qWork.size() + nSpilled.load();
+	}
+
+	/*
+		stealWork
+
+		큐에서 가장 오래 기다린 workItem들을 최대 maxCount개 꺼내 workItems에 더한다.
+		꺼낸 workItem은 이 풀에서 처리되지 않으며, 저널에서도 완료로 기록된다.
+		( 다른 풀로 넘겨 처리하게 할 때 사용한다. PoolFederation.h 참고 )
+
+		journalIds를 주면 저널에 완료로 기록하지 않고 그 레코드 id들을 더한다.
+		넘겨받은 쪽이 받았다고 확인한 뒤에 completeStolen으로 기록한다.
+
+		반환값 : 꺼낸 workItem의 수
+	*/
+	size_t stealWork(std::vector<T> &workItems, size_t maxCount,
+			 std::vector<uint64_t> *journalIds = nullptr){
+		std::vector<uint64_t> completed;
+		std::vector<uint64_t> &ids = journalIds != nullptr ? *journalIds : completed;
+		size_t count = 0;
+		{
+			std::unique_lock<std::mutex> guard( queueMutex );
+
+			while( count < maxCount && !qWork.empty() ){
+				workEntry_t &entry = qWork.front();
+
+				queuedBytes.fetch_sub( entry.bytes );
+				if( entry.journalId != 0 )
+					ids.push_back( entry.journalId );
+
+				workItems.push_back( std::move(entry.item) );
+				qWork.pop();
+				count ++;
+			}
+		}
+
+		completeStolen( completed );
+
+		if( count > 0 && nBlocked > 0 )
+			spaceSignal.notify_all();
+
+		return count;
+	}
+
+	/*
+		completeStolen
+
+		stealWork로 꺼내며 받아둔 저널 레코드들을 완료로 기록한다.
+	*/
+	void completeStolen(const std::vector<uint64_t> &journalIds){
+		for( uint64_t id : journalIds )
+			journal->complete( id );
+	}
+
+	/*
+		blocking
+
+		핸들러 안에서 락, 동기 RPC처럼 오래 블록될 수 있는 구간을 fn으로 감싸 실행한다.
+		fn이 도는 동안 이 worker는 일하는 worker로 세지 않고, 그만큼 maxWorker를 넘어
+		spare worker를 둘 수 있게 하여 CPU가 놀지 않게 한다. ( ForkJoinPool의 managed blocking )
+		큐에 일이 쌓여 있으면 바로 spare를 하나 띄운다.
+		fn이 끝나면 한도가 돌아오고, 남는 worker는 workItem 사이에서 종료한다.
+		governor를 쓰면 fn 안에서 잡은 락을 쥔 채 돌아와 자리를 기다릴 수 있는데,
+		그 락을 기다리는 worker들이 자리를 쥐고 있어도 reclaimTimeout 뒤에는 예산을 넘어
+		자리를 얻으므로 서로 기다리며 멈추지 않는다.
+
+		이 풀의 worker가 아닌 쓰레드에서 부르면 fn만 실행한다.
+
+			pool.blocking( [&](){ return rpc.call( request ); } );
+
+		반환값 : fn의 반환값
+	*/
+	template <typename F>
+	decltype(auto) blocking(F &&fn){
+		if( currentPool() != this )
+			return fn();
+
+		blockingScope_t scope( this, beginBlocking() );
+
+		return fn();
+	}
+
+	/*
+		setBlockingSpares
+
+		blocking으로 블록된 worker를 대신해 maxWorker를 넘어 둘 수 있는 spare worker의 상한
+		( 기본값은 maxWorker, 0이면 보충하지 않는다. )
+	*/
+	void setBlockingSpares(int maxSpares){
+		maxBlockingSpares.store( maxSpares > 0 ? maxSpares : 0 );
+	}
+
+	/*
+		enableUtilizationScaling
+
+		핸들러를 부를 때마다 쓰레드 CPU 시간( CLOCK_THREAD_CPUTIME_ID )과 벽시계 시간을 재어
+		핸들러의 CPU 사용률을 지수 이동 평균으로 추정하고, worker 한도를 그에 맞춘다.
+		CPU가 모자라 run queue에서 기다린 시간은 벽시계 시간에서 뺀다.
+		( 그대로 두면 CPU만 쓰는 핸들러도 과부하에서는 I/O를 기다리는 것처럼 보인다. )
+
+			한도 = cpus / 사용률 ( cpus 이상 maxWorker 이하 )
+
+		핸들러가 대부분 I/O를 기다리면 maxWorker까지 늘리고,
+		CPU만 쓰면 cpus에서 멈추며 넘는 worker는 workItem 사이에서 종료한다.
+		표본이 충분히 모이기 전에는 maxWorker를 쓴다.
+
+		cpus : CPU 수 ( 0이면 cgroup quota, cpuset, affinity로 정한 CPU 수를 실행 중에도
+		       따라간다. ( CgroupCpu.h 참고 ) 음수면 끈다. )
+	*/
+	void enableUtilizationScaling(int cpus = 0){
+		utilization.store( 0 );
+		nUtilizationSamples.store( 0 );
+		utilizationCpus.store( cpus == 0 ? autoCpus : std::max( cpus, 0 ) );
+	}
+
+	/*
+		setCgroupAware
+
+		사용률 스케일링을 쓰지 않을 때 worker 한도를 컨테이너가 실제로 쓸 수 있는 CPU 수
+		( cgroup v2 cpu.max, cpuset.cpus.effective, affinity 중 가장 작은 값 )로 제한한다.
+		값은 주기적으로 다시 읽으므로 quota가 줄면 넘는 worker는 workItem 사이에서 종료하고,
+		늘면 enqueue가 다시 worker를 만든다. blocking을 보충하는 spare는 따로 센다.
+
+		enable : 켤지 여부
+	*/
+	void setCgroupAware(bool enable){
+		cgroupAware.store( enable );
+	}
+
+	/*
+		queryUtilization
+
+		utilization : 핸들러의 평균 CPU 사용률( 0 ~ 1 )을 받아올 포인터
+		limit : 지금의 worker 한도를 받아올 포인터
+	*/
+	void queryUtilization(double *_utilization,int *limit){
+		if( _utilization != nullptr )
+			*_utilization = utilization.load() / (double)utilizationScale;
+		if( limit != nullptr )
+			*limit = workerLimit();
+	}
+
+	/*
+		enableLatencySlo
+
+		worker 수를 enqueue에서 핸들러 시작까지의 대기 시간 p99로 조절한다.
+		조절 쓰레드가 주기마다 그 주기의 p99를 재어 PI 조절기로 목표 worker 수를 정하고,
+		모자라면 worker를 만들고 넘으면 workItem 사이에서 종료시킨다.
+		이때부터 enqueue는 쉬는 worker가 없어도 worker를 바로 만들지 않는다.
+
+		목표 worker 수는 minWorkers( 1 이상 ) 이상 maxWorker 이하이며,
+		사용률 스케일링( enableUtilizationScaling )을 켰으면 그 한도도 넘지 않는다.
+		다시 부르면 조절기를 새 설정으로 바꾼다.
+
+		slo : 대기 시간 목표와 조절기 설정
+	*/
+	void enableLatencySlo(const LatencySlo &slo){
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		sloController = SloController( slo, maxWorker, nWorker.load() );
+		sloWorkers.store( sloController.workers() );
+		queueWait.clear();
+		sloEnabled.store( true );
+
+		if( !sloThread.joinable() )
+			sloThread = std::thread( &DynamicProcessPool::slothread, this );
+		sloSignal.notify_all();
+	}
+
+	/*
+		queryLatencySlo
+
+		p99 : 지난 주기의 대기 시간 p99( ns )를 받아올 포인터
+		target : 조절기가 정한 worker 수를 받아올 포인터
+	*/
+	void queryLatencySlo(uint64_t *p99,int *target){
+		if( p99 != nullptr )
+			*p99 = lastQueueWaitP99.load();
+		if( target != nullptr )
+			*target = sloWorkers.load();
+	}
+
+	/*
+		setGovernor
+
+		프로세스 전체의 active worker 예산을 나눠 쓰도록 governor에 등록한다.
+		worker는 큐에서 workItem을 꺼내기 전에 governor의 자리를 얻고, 큐가 비어 쉬거나
+		blocking에 들어가거나 빌려 쓰던 자리를 돌려줘야 할 때 반납한다.
+		worker 한도도 governor의 예산을 넘지 않는다. ( blocking을 보충하는 spare는 따로 )
+		blocking에서 돌아온 worker는 자리가 날 때까지 기다렸다가 다른 worker보다 먼저 얻는다.
+		( governor의 reclaimTimeout까지만 기다리고, 지나면 예산을 넘어 임시로 얻는다. )
+		enqueue를 시작하기 전에 한 번만 호출해야 하며, 풀이 종료할 때 등록이 지워진다.
+
+		_governor : 함께 쓸 governor ( 보통 ThreadGovernor::shared(), 풀보다 오래 살아야 한다. )
+		weight : 예산을 나누는 가중치
+	*/
+	void setGovernor(ThreadGovernor &_governor, double weight = 1.0){
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		governorId = _governor.registerPool( weight, [this](){
+			signal.notify_all();
+		});
+		governor = &_governor;
+	}
+
+	/*
+		queryBlockingStatus
+
+		blocking : blocking 안에서 블록된 worker의 수를 받아올 포인터
+		spares : maxWorker를 넘어 떠 있는 spare worker의 수를 받아올 포인터
+	*/
+	void queryBlockingStatus(int *blocking,int *spares){
+		if( blocking != nullptr )
+			*blocking = nBlockingWorkers.load();
+		if( spares != nullptr )
+			*spares = std::max( nWorker.load() - maxWorker, 0 );
+	}
+
+	/*
+		setMemoryBudget
+
+		workItem의 크기를 바이트 단위로 계산하고 큐의 용량을 제한한다.
+
+		_sizer : workItem의 크기를 반환하는 함수
+		_maxQueuedBytes : 큐에 쌓일 수 있는 바이트의 상한 ( 0이면 무제한 )
+	*/
+	void setMemoryBudget(sizer_t _sizer, size_t _maxQueuedBytes){
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		sizer = _sizer;
+		maxQueuedBytes = _maxQueuedBytes;
+
+		spaceSignal.notify_all();
+	}
+
+	/*
+		enableSpill
+
+		큐에 쌓인 바이트가 threshold를 넘으면 이후의 workItem들을
+		memory-mapped segment 파일에 쌓아두고, 큐가 비워지는 대로 다시 읽어 들인다.
+		T에 대한 PoolCodec이 있어야 한다.
+		디스크가 차서 segment를 만들지 못하면 enqueue가 std::system_error를 던진다.
+
+		directory : segment 파일을 만들 디렉토리
+		threshold : 메모리 큐에 담아둘 바이트 상한
+		segmentSize : segment 파일 하나의 크기
+	*/
+	void enableSpill(const std::string &directory, size_t threshold,
+			 size_t segmentSize = 64 * 1024 * 1024){
+		static_assert( PoolCodec<T>::supported,
+			"DynamicProcessPool : spill requires a PoolCodec<T> specialization" );
+
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		// 크기 측정 함수가 없으면 직렬화된 크기로 잰다.
+		if( !sizer )
+			sizer = [](const T &item){ return PoolCodec<T>::encodedSize( item ); };
+
+		spill.reset( new SpillQueue( directory, segmentSize ) );
+		spillThreshold = threshold;
+	}
+
+	/*
+		enableJournal
+
+		enqueue되는 workItem을 write-ahead 로그에 기록하고, 처리가 끝나면 완료를 기록한다.
+		로그에 지난 실행에서 끝나지 못한 workItem이 남아있으면 바로 다시 큐에 넣는다.
+		T에 대한 PoolCodec이 있어야 하며, enqueue를 시작하기 전에 호출해야 한다.
+
+		path : 로그 파일 경로
+		_durableEnqueue : true면 enqueue가 로그가 디스크에 기록될 때까지 기다린다
+		commitInterval : group commit( write + fdatasync ) 주기
+	*/
+	void enableJournal(const std::string &path, bool _durableEnqueue = true,
+			   std::chrono::microseconds commitInterval = std::chrono::microseconds( 2000 )){
+		static_assert( PoolCodec<T>::supported,
+			"DynamicProcessPool : journal requires a PoolCodec<T> specialization" );
+
+		journal.reset( new PoolJournal( path, commitInterval ) );
+		durableEnqueue = _durableEnqueue;
+
+		journal->template replay<T>( [this](uint64_t id, T &&workItem){
+			workEntry_t entry;
+
+			entry.bytes = sizer ? sizer( workItem ) : 0;
+			entry.journalId = id;
+			entry.enqueuedAt = enqueueStamp();
+			entry.item = std::move( workItem );
+
+			dispatch( std::move(entry) );
+		});
+	}
+
+	/*
+		setRecyclePolicy
+
+		처리 횟수( lifeTime )와 별개로 worker를 교체할 조건을 지정한다.
+		worker들은 workItem 사이에서 checkInterval마다 조건을 검사하고,
+		한도를 넘으면 새 worker에게 자리를 넘기고 종료한다.
+		이미 실행 중인 worker에도 다음 workItem부터 적용된다.
+
+		policy : 교체 조건
+		memoryProbe : 메모리 사용량을 재는 함수.
+		              없으면 malloc 통계( 프로세스 전체의 사용 중인 힙 )를 쓰므로
+		              다른 worker의 증가도 함께 잡힌다. jemalloc의 thread.allocated처럼
+		              쓰레드별 통계가 있으면 그것을 넘기는 것이 정확하다.
+	*/
+	void setRecyclePolicy(const RecyclePolicy &policy,
+			      RecycleMeter::probe_t memoryProbe = RecycleMeter::probe_t()){
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		recyclePolicy = policy;
+		recycleProbe = memoryProbe ? memoryProbe : RecycleMeter::probe_t( heapInUseBytes );
+		recycleVersion.fetch_add( 1 );
+	}
+
+	/*
+		setScratchArena
+
+		worker별 ScratchArena의 설정을 바꾼다.
+		이후 생성되는 worker부터 적용된다.
+
+		chunkSize : arena가 한 번에 잡는 chunk의 크기
+		retainSize : reset 후에도 남겨둘 chunk 용량 ( 넘는 부분은 trim )
+		resetInterval : 몇 개의 workItem을 처리할 때마다 arena를 reset할지
+	*/
+	void setScratchArena(size_t chunkSize, size_t retainSize, int resetInterval){
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		arenaChunkSize = chunkSize;
+		arenaRetainSize = retainSize;
+		arenaResetInterval = resetInterval > 0 ? resetInterval : 1;
+	}
+
+	/*
+		setIoRingEntries
+
+		I/O 모드 worker가 가지는 io_uring의 SQ 크기를 바꾼다.
+		이후 생성되는 worker부터 적용된다.
+
+		entries : worker 하나가 한 번에 걸어둘 수 있는 I/O의 수
+	*/
+	void setIoRingEntries(unsigned entries){
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		ioRingEntries = entries > 0 ? entries : 1;
 	}
 
 	/*
@@ -93,15 +615,30 @@ public:
 	void kill(){
 		postQuitWorkers();
 
-		for( auto &worker : workers )
-			worker.detach();
-		workers.clear();
+		if( sloThread.joinable() )
+			sloThread.join();
 
+		waitWorkers();
+
+		// worker들이 모두 자리를 돌려준 뒤에 등록을 지운다.
+		if( governor != nullptr ){
+			governor->unregisterPool( governorId );
+			governor = nullptr;
+		}
+	}
+
+protected:
+	/*
+		waitWorkers
+
+		모든 worker가 종료할 때까지 기다린다.
+	*/
+	void waitWorkers(){
 		// spin wait
 		//   joinable, join 사이에 컨텍스트 스위칭을 막으려고 락을 쓰는 것 대신
 		//   spin wait를 사용한다.
 		int spinCount = 10000;
-		while( nWorker.load() > 0 ){
+		while( nWorker.load() > 0 || nExiting.load() > 0 ){
 			if( spinCount )
 				spinCount --;
 			else{
@@ -111,24 +648,285 @@ public:
 		}
 	}
 
-protected:
+	/*
+		dispatch
+
+		workEntry를 새 worker나 work queue로 보낸다.
+	*/
+	void dispatch(workEntry_t entry){
+		// 비어있는 worker가 없고 maxWorker만큼 worker가 없으면
+		// 새 worker를 생성하고 일을 할당.
+		//   spill된 workItem이 있으면 순서를 지키기 위해 큐를 거친다.
+		//   대기 시간 SLO를 쓰면 worker 수는 조절기가 정하므로 큐로만 보낸다.
+		//   governor를 쓰면 worker가 자리를 얻은 뒤에 꺼내도록 큐로 보낸다.
+		if( !sloEnabled.load() && governor == nullptr && nWaiting.load() == 0 && nSpilled.load() == 0 && reserveWorker() ){
+			inflightBytes.fetch_add( entry.bytes );
+			addWorkerWithWork( lifeTime, std::move(entry) );
+		}
+		else{
+			std::unique_lock<std::mutex> guard( queueMutex );
+
+				// spill
+				//   한 번 spill이 시작되면 FIFO를 지키기 위해
+				//   spill이 빌 때까지 새 workItem도 모두 spill로 보낸다.
+				if constexpr( PoolCodec<T>::supported ){
+					if( spill != nullptr &&
+						( !spill->empty() ||
+						  queuedBytes.load() + entry.bytes > spillThreshold ) ){
+
+						spill->push( entry.item, entry.journalId );
+						nSpilled.store( spill->size() );
+						guard.unlock();
+
+						if( nWaiting.load() > 0 )
+							signal.notify_one();
+						wakeIoWaiters();
+						return;
+					}
+				}
+
+				// backpressure
+				//   큐가 비어있으면 예산보다 큰 workItem이라도 받아들인다.
+				if( maxQueuedBytes > 0 ){
+					nBlocked ++;
+					spaceSignal.wait( guard, [&](){
+						return quit ||
+							queuedBytes.load() == 0 ||
+							queuedBytes.load() + entry.bytes <= maxQueuedBytes;
+					});
+					nBlocked --;
+				}
+
+				queuedBytes.fetch_add( entry.bytes );
+				qWork.push( std::move(entry) );
+			guard.unlock();
+
+			// signal을 기다리는 worker가 있을 때만 notify
+			if( nWaiting.load() > 0 )
+				signal.notify_one();
+			else if( governor != nullptr && !sloEnabled.load() && reserveWorker() )
+				addWorker( lifeTime );
+			wakeIoWaiters();
+		}
+	}
+
+	/*
+		wakeIoWaiters
+
+		I/O 완료를 기다리느라 signal을 받지 못하는 worker들을 깨운다.
+	*/
+	void wakeIoWaiters(){
+		if( nIoWaiting.load() == 0 )
+			return;
+
+		std::unique_lock<std::mutex> guard( queueMutex );
+		for( IoContext *io : ioWaiters )
+			io->wake();
+	}
+
+	// worker 하나가 사용률 표본을 모으는 구간
+	typedef struct{
+		uint64_t cpuNanos;	// 구간 동안 핸들러의 CPU 시간
+		uint64_t wallNanos;	// 구간 동안 핸들러의 벽시계 시간
+		uint64_t runDelay;	// 구간 동안 핸들러가 run queue에서 기다린 시간
+		int count;		// 구간 동안의 핸들러 호출 수
+	} utilizationWindow_t;
+
+	/*
+		invokeHandler
+
+		핸들러의 형태에 맞게 arena나 I/O 문맥을 넘겨서 호출한다.
+	*/
+	bool invokeHandler(T &workItem, S &state, ScratchArena &arena, IoContext *io){
+		if constexpr( std::is_invocable_r<bool, handler_t&, T&, S&, IoContext&>::value )
+			return handler( workItem, state, *io );
+		else if constexpr( std::is_invocable_r<bool, handler_t&, T&, IoContext&>::value )
+			return handler( workItem, *io );
+		else if constexpr( std::is_invocable_r<bool, handler_t&, T&, S&, ScratchArena&>::value )
+			return handler( workItem, state, arena );
+		else if constexpr( std::is_invocable_r<bool, handler_t&, T&, S&>::value )
+			return handler( workItem, state );
+		else if constexpr( std::is_invocable_r<bool, handler_t&, T&, ScratchArena&>::value )
+			return handler( workItem, arena );
+		else
+			return handler( workItem );
+	}
+
+	/*
+		doWork
+
+		workEntry 하나를 처리한다.
+	*/
+	bool doWork(workEntry_t &entry, S &state, ScratchArena &arena, IoContext *io,
+		    utilizationWindow_t &window){
+		bool result;
+		bool sample = utilizationCpus.load() != 0;
+		uint64_t cpuStart = 0, wallStart = 0, runDelayStart = 0;
+
+		// run queue 대기도 핸들러 호출 안의 것만 센다. ( 큐를 기다리며 쉰 시간은 빼고 )
+		if( sample ){
+			runDelayStart = runDelayNanos();
+			cpuStart = clockNanos( CLOCK_THREAD_CPUTIME_ID );
+			wallStart = clockNanos( CLOCK_MONOTONIC );
+		}
+
+		nWorking.fetch_add(1);
+			result = invokeHandler( entry.item, state, arena, io );
+		nWorking.fetch_sub(1);
+
+		if( sample ){
+			window.cpuNanos += clockNanos( CLOCK_THREAD_CPUTIME_ID ) - cpuStart;
+			window.wallNanos += clockNanos( CLOCK_MONOTONIC ) - wallStart;
+			window.runDelay += runDelayNanos() - runDelayStart;
+			window.count ++;
+
+			if( window.count >= utilizationWindowCount || window.wallNanos >= utilizationWindowNanos )
+				closeUtilizationWindow( window );
+		}
+
+		inflightBytes.fetch_sub( entry.bytes );
+
+		if( entry.journalId != 0 )
+			journal->complete( entry.journalId );
+
+		return result;
+	}
+
 	/*
 		workthread
 
 		worker 쓰레드
+
+		lifeCount : 라이프카운트
+		firstWork : 생성 후 바로 처리할 workItem ( 없으면 nullptr )
 	*/
-	void workthread(int lifeCount){
-		nWorker.fetch_add( 1 );
+	void workthread(int lifeCount, workEntry_t *firstWork){
+		// 남는 worker로 종료하면 nWorker는 이미 줄어 있다.
+		if( runWorker( lifeCount, firstWork ) ){
+			nExiting.fetch_sub( 1 );
+			return;
+		}
+
+		// lifeTime을 다해서 종료하는 worker는 자리를 넘겨받을 새 worker를 만든다.
+		//   nWorker는 넘겨주는 동안 줄어들지 않는다.
+		{
+			std::unique_lock<std::mutex> guard( queueMutex );
+			if( !quit ){
+				guard.unlock();
+				addWorker( lifeTime );
+				return;
+			}
+		}
+
+		nWorker.fetch_sub( 1 );
+	}
+
+	/*
+		runWorker
+
+		worker 상태를 준비하고 lifeCount만큼 workItem을 처리한다.
+
+		반환값 : worker 한도를 넘는 남는 worker로 종료했는지 여부
+	*/
+	bool runWorker(int lifeCount, workEntry_t *firstWork){
+		// worker 상태는 worker가 workItem을 받기 전에 준비된다.
+		S state;
+		if( onWorkerStart )
+			onWorkerStart( state );
+
+		int resetInterval;
+		size_t chunkSize, retainSize;
+		unsigned ringEntries;
+		{
+			std::unique_lock<std::mutex> guard( queueMutex );
+			resetInterval = arenaResetInterval;
+			chunkSize = arenaChunkSize;
+			retainSize = arenaRetainSize;
+			ringEntries = ioRingEntries;
+		}
 
-		while( !quit && lifeCount > 0 ){
-			T workItem;
+		// worker 전용 scratch arena
+		//   resetInterval개의 workItem마다 되감고,
+		//   worker가 lifeTime을 다하면 소멸과 함께 해제된다.
+		ScratchArena arena( chunkSize, retainSize );
+		int sinceReset = 0;
+
+		// 교체 조건
+		//   lifeCount와 별개로 메모리 증가, CPU 시간, 나이가 한도를 넘으면
+		//   workItem 사이에서 worker를 교체한다.
+		RecyclePolicy policy;
+		RecycleMeter::probe_t memoryProbe;
+		int policyVersion = loadRecyclePolicy( policy, memoryProbe );
+		RecycleMeter meter( CLOCK_THREAD_CPUTIME_ID, memoryProbe );
+
+		// I/O 모드 worker 전용 io_uring
+		std::unique_ptr<IoContext> io;
+		if constexpr( ioHandler ){
+			io.reset( new IoContext( ringEntries ) );
+
+			// 종료할 때 postQuitWorkers가 I/O를 취소할 수 있게 등록한다.
+			std::unique_lock<std::mutex> guard( queueMutex );
+			ioContexts.push_back( io.get() );
+			if( quit )
+				io->cancel();
+		}
+
+		currentPool() = this;
+		bool retired = false;
+
+		// 사용률 표본을 모으는 구간
+		utilizationWindow_t window = { 0, 0, 0, 0 };
+
+		while( lifeCount > 0 && ( firstWork != nullptr || !quit ) ){
+			workEntry_t entry;
 			bool result;
 
-			{	
+			// blocking이 끝나 한도를 넘는 worker는 자리를 돌려주고 종료한다.
+			if( firstWork == nullptr && retireSurplus() ){
+				retired = true;
+				break;
+			}
+
+			if( firstWork != nullptr ){
+				entry = std::move( *firstWork );
+				firstWork = nullptr;
+			}
+			else{
+				// 완료된 I/O의 continuation을 먼저 부른다.
+				if( io )
+					io->poll();
+
 				std::unique_lock<std::mutex> guard( queueMutex );
 				
+				refillFromSpill();
+
 				// double check
 				if( qWork.empty() ){
+					// 쉬는 동안은 governor의 자리를 돌려준다.
+					if( governor != nullptr ){
+						releaseSlot();
+						governor->withdraw( governorId );
+					}
+
+					if( quit )
+						break;
+
+					// I/O가 남아있으면 signal 대신 I/O 완료나 wakeIoWaiters를 기다린다.
+					if( io && io->pending() > 0 ){
+						nWaiting.fetch_add(1);
+						nIoWaiting.fetch_add(1);
+						ioWaiters.push_back( io.get() );
+						guard.unlock();
+
+							io->wait();
+
+						guard.lock();
+						ioWaiters.erase( std::find( ioWaiters.begin(), ioWaiters.end(), io.get() ) );
+						nIoWaiting.fetch_sub(1);
+						nWaiting.fetch_sub(1);
+						continue;
+					}
+
 					nWaiting.fetch_add(1);
 						signal.wait( guard );
 					nWaiting.fetch_sub(1);	
@@ -137,33 +935,358 @@ protected:
 						continue;
 				}
 
-				workItem = qWork.front();
+				// governor의 자리가 없으면 자리가 날 때까지 쉰다.
+				//   자리가 나면 governor가 signal로 깨우지만, 락 없이 깨우므로 시간 제한을 둔다.
+				if( governor != nullptr && !heldSlot() ){
+					if( !governor->acquire( governorId ) ){
+						nWaiting.fetch_add(1);
+							signal.wait_for( guard, std::chrono::milliseconds( 10 ) );
+						nWaiting.fetch_sub(1);
+						continue;
+					}
+					heldSlot() = true;
+				}
+
+				entry = std::move( qWork.front() );
 				qWork.pop();
+
+				queuedBytes.fetch_sub( entry.bytes );
+				inflightBytes.fetch_add( entry.bytes );
+				guard.unlock();
+
+				// backpressure로 블록된 enqueue가 있으면 깨운다.
+				if( nBlocked > 0 )
+					spaceSignal.notify_all();
 			}
 
-			nWorking.fetch_add(1);
-				result = handler( workItem );
-			nWorking.fetch_sub(1);
+			if( entry.enqueuedAt != 0 )
+				queueWait.record( clockNanos( CLOCK_MONOTONIC ) - entry.enqueuedAt );
+
+			result = doWork( entry, state, arena, io.get(), window );
+
+			// 빌려 쓰던 자리를 몫이 모자란 풀에게 돌려준다.
+			if( governor != nullptr && heldSlot() && governor->shouldYield( governorId ) )
+				releaseSlot();
 
 			lifeCount --;
+			if( ++sinceReset >= resetInterval ){
+				arena.reset();
+				sinceReset = 0;
+			}
+
+			if( recycleVersion.load() != policyVersion ){
+				policyVersion = loadRecyclePolicy( policy, memoryProbe );
+				meter = RecycleMeter( CLOCK_THREAD_CPUTIME_ID, memoryProbe );
+			}
+			if( meter.expired( policy ) )
+				break;
 		}
 
-		nWorker.fetch_sub( 1 );
+		// 걸어둔 I/O가 모두 끝나야 worker를 넘길 수 있다.
+		//   종료 중이면 postQuitWorkers가 취소하므로 오지 않는 데이터를 기다리지 않는다.
+		if( io ){
+			io->drain();
+
+			std::unique_lock<std::mutex> guard( queueMutex );
+			ioContexts.erase( std::find( ioContexts.begin(), ioContexts.end(), io.get() ) );
+		}
+
+		if( governor != nullptr )
+			releaseSlot();
+		currentPool() = nullptr;
+
+		if( onWorkerStop )
+			onWorkerStop( state );
+
+		return retired;
+	}
+
+	/*
+		loadRecyclePolicy
+
+		현재 교체 조건을 복사하고 그 버전을 반환한다.
+	*/
+	int loadRecyclePolicy(RecyclePolicy &policy, RecycleMeter::probe_t &memoryProbe){
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		policy = recyclePolicy;
+		memoryProbe = recycleProbe;
+		return recycleVersion.load();
+	}
+
+	/*
+		refillFromSpill
+
+		메모리 큐가 threshold의 절반 아래로 내려가면
+		spill된 workItem들을 threshold까지 다시 채운다.
+		queueMutex를 잡은 상태에서 호출해야 한다.
+	*/
+	void refillFromSpill(){
+		if constexpr( PoolCodec<T>::supported ){
+			if( spill == nullptr || spill->empty() )
+				return;
+			if( !qWork.empty() && queuedBytes.load() >= spillThreshold / 2 )
+				return;
+
+			while( !spill->empty() &&
+				( qWork.empty() || queuedBytes.load() < spillThreshold ) ){
+				workEntry_t entry;
+
+				spill->pop( entry.item, &entry.journalId );
+				entry.bytes = sizer( entry.item );
+				entry.enqueuedAt = enqueueStamp();	// spill에서 기다린 시간은 빠진다.
+
+				queuedBytes.fetch_add( entry.bytes );
+				qWork.push( std::move(entry) );
+			}
+
+			nSpilled.store( spill->size() );
+		}
+	}
+
+	/*
+		reserveWorker
+
+		maxWorker를 넘지 않는 경우에만 worker 자리를 하나 예약한다.
+	*/
+	bool reserveWorker(){
+		int current = nWorker.load();
+
+		while( current < workerLimit() ){
+			if( nWorker.compare_exchange_weak( current, current + 1 ) )
+				return true;
+		}
+		return false;
+	}
+
+	/*
+		enqueueStamp
+
+		대기 시간 SLO를 쓰면 지금 시각( ns ), 아니면 0
+	*/
+	uint64_t enqueueStamp(){
+		return sloEnabled.load() ? clockNanos( CLOCK_MONOTONIC ) : 0;
+	}
+
+	/*
+		slothread
+
+		대기 시간 SLO 조절 쓰레드
+		주기마다 대기 시간 p99로 목표 worker 수를 갱신하고 worker 수를 맞춘다.
+	*/
+	void slothread(){
+		std::unique_lock<std::mutex> guard( queueMutex );
+
+		while( !quit ){
+			guard.unlock();
+
+			// 모자라면 만들고, 넘으면 쉬는 worker를 깨워 종료하게 한다.
+			while( reserveWorker() )
+				addWorker( lifeTime );
+			if( nWorker.load() > workerLimit() )
+				signal.notify_all();
+
+			guard.lock();
+
+			sloSignal.wait_for( guard, sloController.policy().interval );
+			if( quit )
+				break;
+
+			uint64_t samples;
+			uint64_t p99 = queueWait.percentile( 0.99, &samples );
+			queueWait.clear();
+
+			// 아직 시작하지 못한 workItem은 표본에 없으므로 가장 오래 기다린 workItem의 대기 시간도 본다.
+			bool queued = !qWork.empty() || nSpilled.load() > 0;
+			if( !qWork.empty() && qWork.front().enqueuedAt != 0 )
+				p99 = std::max( p99, clockNanos( CLOCK_MONOTONIC ) - qWork.front().enqueuedAt );
+
+			sloWorkers.store( sloController.update( p99, queued && samples == 0 ) );
+			lastQueueWaitP99.store( p99 );
+		}
+	}
+
+	/*
+		workerLimit
+
+		지금 둘 수 있는 worker의 수 ( maxWorker + blocking을 보충하는 spare )
+	*/
+	int workerLimit(){
+		int limit = utilizationLimit();
+		if( sloEnabled.load() )
+			limit = std::min( limit, sloWorkers.load() );
+		if( governor != nullptr )
+			limit = std::min( limit, governor->budget() );
+
+		return limit + std::min( nBlockingWorkers.load(), maxBlockingSpares.load() );
+	}
+
+	/*
+		utilizationLimit
+
+		핸들러의 CPU 사용률로 정한 worker 한도 ( 표본이 모자라면 maxWorker )
+		사용률 스케일링을 끄면 maxWorker ( setCgroupAware면 CPU 수 이하 )
+	*/
+	int utilizationLimit(){
+		int cpus = utilizationCpus.load();
+		if( cpus == 0 )
+			return cgroupAware.load() ? std::min( maxWorker, availableCpus() ) : maxWorker;
+		if( nUtilizationSamples.load() < utilizationWarmup )
+			return maxWorker;
+		if( cpus == autoCpus )
+			cpus = availableCpus();
+
+		// 사용률이 아주 낮아도 cpus의 utilizationScale / utilizationFloor배에서 멈춘다.
+		uint32_t rate = std::max( utilization.load(), utilizationFloor );
+		uint64_t limit = ( (uint64_t)cpus * utilizationScale + rate / 2 ) / rate;
+
+		return (int)std::min<uint64_t>( std::max<uint64_t>( limit, cpus ), maxWorker );
+	}
+
+	/*
+		closeUtilizationWindow
+
+		구간 동안 핸들러들의 CPU 시간과, run queue 대기를 뺀 벽시계 시간으로
+		사용률 평균을 갱신하고 구간을 비운다.
+	*/
+	void closeUtilizationWindow(utilizationWindow_t &window){
+		uint64_t runDelay = window.runDelay;
+		uint64_t wallNanos = window.wallNanos > runDelay ? window.wallNanos - runDelay : 0;
+		uint64_t cpuNanos = window.cpuNanos;
+
+		window = { 0, 0, 0, 0 };
+
+		uint32_t rate = wallNanos == 0 ? utilizationScale :
+			(uint32_t)std::min<uint64_t>( cpuNanos * utilizationScale / wallNanos, utilizationScale );
+
+		// 1/4 가중치의 지수 이동 평균 ( 첫 표본은 그대로 )
+		uint32_t current = utilization.load();
+		uint32_t next;
+		do{
+			next = nUtilizationSamples.load() == 0 ? rate :
+				(uint32_t)( ( (uint64_t)current * 3 + rate ) / 4 );
+		}while( !utilization.compare_exchange_weak( current, next ) );
+
+		nUtilizationSamples.fetch_add( 1 );
+	}
+
+	/*
+		retireSurplus
+
+		worker의 수가 한도를 넘으면 하나를 줄인다.
+		반환값 : 줄였으면 true ( 호출한 worker가 종료해야 한다. )
+	*/
+	bool retireSurplus(){
+		int current = nWorker.load();
+
+		// 자리를 먼저 돌려주므로 kill이 이 worker를 기다리도록 nExiting으로 센다.
+		nExiting.fetch_add( 1 );
+		while( current > workerLimit() ){
+			if( nWorker.compare_exchange_weak( current, current - 1 ) )
+				return true;
+		}
+		nExiting.fetch_sub( 1 );
+		return false;
+	}
+
+	/*
+		beginBlocking / endBlocking
+
+		worker를 블록된 것으로 세고, 큐에 일이 있는데 쉬는 worker가 없으면 spare를 띄운다.
+	*/
+	bool beginBlocking(){
+		bool released = governor != nullptr && heldSlot();
+
+		nWorking.fetch_sub(1);
+		nBlockingWorkers.fetch_add(1);
+
+		// 블록되는 동안 governor의 자리는 다른 worker가 쓴다.
+		if( released )
+			releaseSlot();
+
+		if( nWaiting.load() > 0 )
+			return released;
+
+		bool queued;
+		{
+			std::unique_lock<std::mutex> guard( queueMutex );
+			queued = !qWork.empty() || nSpilled.load() > 0;
+		}
+
+		if( queued && reserveWorker() )
+			addWorker( lifeTime );
+		return released;
+	}
+	void endBlocking(bool reacquire){
+		// 하던 workItem을 마저 끝내도록 새로 시작하는 worker보다 먼저 자리를 다시 얻는다.
+		//   그동안 자리를 쓰던 spare들은 workItem 사이의 shouldYield로 자리를 내준다.
+		if( reacquire ){
+			governor->reclaim( governorId );
+			heldSlot() = true;
+		}
+
+		nBlockingWorkers.fetch_sub(1);
+		nWorking.fetch_add(1);
+
+		// 쉬고 있는 남는 worker가 있으면 깨워서 종료하게 한다.
+		if( nWorker.load() > workerLimit() && nWaiting.load() > 0 )
+			signal.notify_one();
+	}
+
+	struct blockingScope_t{
+		blockingScope_t(DynamicProcessPool *_pool, bool _reacquire) :
+			pool( _pool ), reacquire( _reacquire ) {
+		}
+		~blockingScope_t(){
+			pool->endBlocking( reacquire );
+		}
+
+		DynamicProcessPool *pool;
+		bool reacquire;		// governor의 자리를 돌려줬는지
+	};
+
+	/*
+		currentPool
+
+		이 쓰레드가 worker로 일하고 있는 풀 ( worker가 아니면 nullptr )
+	*/
+	static DynamicProcessPool *&currentPool(){
+		static thread_local DynamicProcessPool *current = nullptr;
+		return current;
+	}
+
+	/*
+		heldSlot / releaseSlot
+
+		이 worker가 governor의 자리를 가지고 있는지, 가지고 있으면 돌려준다.
+	*/
+	static bool &heldSlot(){
+		static thread_local bool held = false;
+		return held;
+	}
+	void releaseSlot(){
+		if( heldSlot() ){
+			governor->release( governorId );
+			heldSlot() = false;
+		}
 	}
 
 	/*
 		addWorker
 
 		새 worker를 추가한다.
+		nWorker는 호출하는 쪽에서 미리 늘려둔다.
 
 		lifeCount : 라이프카운트
 	*/
 	void addWorker(int lifeCount){
 		auto boundMethod =
-			std::bind( &DynamicProcessPool::workthread, this, std::placeholders::_1 );
+			std::bind( &DynamicProcessPool::workthread, this,
+				std::placeholders::_1, nullptr );
 
-		workers.push_back(
-			std::thread( boundMethod, lifeCount ));
+		// worker는 스스로 종료하고 kill은 nWorker로 종료를 기다리므로
+		// 쓰레드 핸들을 들고 있지 않는다.
+		worker_t( boundMethod, lifeCount ).detach();
 	}
 
 	/*
@@ -172,17 +1295,12 @@ protected:
 		새 worker를 추가하고 workItem을 넣어준다.
 
 		lifeCount : 라이프카운트
-		workItem : 생성과 후 바로 처리할 workItem
+		entry : 생성과 후 바로 처리할 workEntry
 	*/
-	void addWorkerWithWork(int lifeCount, T workItem){	
-		workers.push_back(
-			std::thread( [=](){
-				bool result;
-
-				result = handler( workItem );
-
-				workthread( lifeCount );
-			}));
+	void addWorkerWithWork(int lifeCount, workEntry_t entry){	
+		worker_t( [=]() mutable{
+			workthread( lifeCount, &entry );
+		}).detach();
 	}
 
 	/*
@@ -191,9 +1309,18 @@ protected:
 		모든 worker에게 종료 요청을 보낸다.
 	*/
 	void postQuitWorkers(){
-		quit = true;
+		{
+			std::unique_lock<std::mutex> guard( queueMutex );
+			quit = true;
+
+			for( IoContext *io : ioContexts )
+				io->cancel();
+		}
 
 		signal.notify_all();
+		spaceSignal.notify_all();
+		sloSignal.notify_all();
+		wakeIoWaiters();
 	}
 
 protected:
@@ -201,16 +1328,79 @@ protected:
 	std::atomic<int> nWaiting;	// signal 을 기다리는 worker의 수
 	std::atomic<int> nWorking;	// handler를 호출하여 일하고 있는 worker의 수
 
-	std::vector<worker_t> workers;	// worker 인스턴스의 목록
-	std::queue<T> qWork;	// work queue
+	std::atomic<size_t> queuedBytes;	// qWork에 쌓인 workItem의 바이트 합
+	std::atomic<size_t> inflightBytes;	// 핸들러가 처리 중인 workItem의 바이트 합
+
+	std::queue<workEntry_t> qWork;	// work queue
 
 	std::condition_variable signal;	// 시그날 객체
+	std::condition_variable spaceSignal;	// 큐에 자리가 났음을 알리는 시그날
 	std::mutex queueMutex;
 
+	sizer_t sizer;		// workItem의 크기 측정 함수
+	size_t maxQueuedBytes;	// qWork의 바이트 상한 ( 0이면 무제한 )
+	std::atomic<int> nBlocked;	// backpressure로 블록된 enqueue의 수
+
+	std::unique_ptr<SpillQueue> spill;	// 디스크 overflow 큐 ( 없으면 nullptr )
+	size_t spillThreshold;		// 메모리 큐에 담아둘 바이트 상한
+	std::atomic<size_t> nSpilled;	// spill에 쌓인 workItem의 수
+
+	RecyclePolicy recyclePolicy;		// worker 교체 조건
+	RecycleMeter::probe_t recycleProbe;	// worker 교체용 메모리 측정 함수
+	std::atomic<int> recycleVersion;	// 교체 조건이 바뀔 때마다 증가
+
+	// 핸들러가 IoContext를 받으면 I/O 모드
+	static constexpr bool ioHandler =
+		std::is_invocable_r<bool, handler_t&, T&, IoContext&>::value ||
+		std::is_invocable_r<bool, handler_t&, T&, S&, IoContext&>::value;
+
+	unsigned ioRingEntries;		// I/O 모드 worker의 io_uring SQ 크기
+	std::vector<IoContext*> ioWaiters;	// I/O 완료를 기다리는 worker들 ( queueMutex )
+	std::vector<IoContext*> ioContexts;	// I/O 모드 worker들의 IoContext ( queueMutex )
+	std::atomic<int> nIoWaiting;		// ioWaiters의 크기
+
+	std::atomic<int> nBlockingWorkers;	// blocking 안에서 블록된 worker의 수
+	std::atomic<int> maxBlockingSpares;	// blocking을 보충하는 spare worker의 상한
+	std::atomic<int> nExiting;		// 자리를 돌려주고 종료하는 중인 worker의 수
+
+	std::atomic<bool> sloEnabled;		// 대기 시간 SLO로 worker 수를 조절하는지
+	SloController sloController;		// 목표 worker 수를 정하는 PI 조절기 ( queueMutex )
+	std::atomic<int> sloWorkers;		// 조절기가 정한 worker 수
+	std::atomic<uint64_t> lastQueueWaitP99;	// 지난 주기의 대기 시간 p99 ( ns )
+	LatencyHistogram queueWait;		// 이번 주기의 대기 시간 분포
+	std::condition_variable sloSignal;	// 조절 쓰레드를 깨우는 시그날
+	std::thread sloThread;			// 조절 쓰레드 ( enableLatencySlo 전에는 없음 )
+
+	ThreadGovernor *governor;	// 함께 쓰는 active worker 예산 ( 없으면 nullptr )
+	int governorId;			// governor에 등록된 id
+
+	static constexpr uint32_t utilizationScale = 1000;	// 사용률 1.0
+	static constexpr uint32_t utilizationFloor = 50;	// 한도 계산에 쓰는 최저 사용률
+	static constexpr uint64_t utilizationWarmup = 4;	// 한도를 정하기 전에 모을 표본( 구간 )의 수
+	static constexpr int utilizationWindowCount = 16;	// 구간 하나의 최대 핸들러 호출 수
+	static constexpr uint64_t utilizationWindowNanos = 50000000;	// 구간 하나의 최대 핸들러 시간
+
+	static constexpr int autoCpus = -1;	// utilizationCpus : availableCpus를 따라간다.
+
+	std::atomic<int> utilizationCpus;		// 사용률 스케일링의 CPU 수 ( 0이면 끔 )
+	std::atomic<bool> cgroupAware;			// 사용률 스케일링 없이 CPU 수로 한도를 둘지
+	std::atomic<uint32_t> utilization;		// 핸들러 CPU 사용률의 평균 ( utilizationScale 기준 )
+	std::atomic<uint64_t> nUtilizationSamples;	// 모은 표본의 수
+
+	std::unique_ptr<PoolJournal> journal;	// write-ahead 로그 ( 없으면 nullptr )
+	bool durableEnqueue;		// enqueue가 로그 기록을 기다릴지
+
 	handler_t handler;
 
+	workerHook_t onWorkerStart;	// worker 시작 훅
+	workerHook_t onWorkerStop;	// worker 종료 훅
+
 	int lifeTime;
 	int maxWorker;
 
-	bool quit;	// postQuit 플래그
+	size_t arenaChunkSize;	// worker별 arena의 chunk 크기
+	size_t arenaRetainSize;	// reset 후 남겨둘 arena 용량
+	int arenaResetInterval;	// arena를 reset할 workItem 간격
+
+	std::atomic<bool> quit;	// postQuit 플래그
 };
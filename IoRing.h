@@ -0,0 +1,587 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+
+#include <functional>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+/*
+	IoRing
+
+	io_uring 하나를 감싼 얇은 래퍼. ( liburing 없이 syscall로 직접 쓴다. )
+	한 쓰레드만 써야 한다.
+
+	prepare로 SQE를 채우고 submit으로 커널에 넘긴 뒤, reap으로 CQE들을 꺼낸다.
+	커널이 io_uring을 지원하지 않거나 막혀 있으면( seccomp 등 ) 생성자가
+	std::system_error를 던진다.
+*/
+class IoRing{
+public:
+	/*
+		IoRing
+
+		entries : SQ의 크기 ( 커널이 2의 거듭제곱으로 올린다. )
+	*/
+	IoRing(unsigned entries) :
+		ringFd( -1 ), sqMap( nullptr ), cqMap( nullptr ), sqeMap( nullptr ),
+		sqMapSize( 0 ), cqMapSize( 0 ), sqeMapSize( 0 ), nUnsubmitted( 0 ) {
+
+		struct io_uring_params params;
+		memset( &params, 0, sizeof(params) );
+
+		ringFd = (int)syscall( __NR_io_uring_setup, entries > 0 ? entries : 1, &params );
+		if( ringFd < 0 )
+			throw std::system_error( errno, std::generic_category(), "IoRing : io_uring_setup" );
+
+		sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		sqeMapSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+		bool singleMap = ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+		if( singleMap )
+			sqMapSize = cqMapSize = std::max( sqMapSize, cqMapSize );
+
+		sqMap = mapRegion( sqMapSize, IORING_OFF_SQ_RING );
+		cqMap = singleMap ? sqMap : mapRegion( cqMapSize, IORING_OFF_CQ_RING );
+		sqeMap = mapRegion( sqeMapSize, IORING_OFF_SQES );
+
+		char *sq = (char*)sqMap;
+		sqHead = (unsigned*)( sq + params.sq_off.head );
+		sqTail = (unsigned*)( sq + params.sq_off.tail );
+		sqMask = *(unsigned*)( sq + params.sq_off.ring_mask );
+		sqEntries = params.sq_entries;
+		sqArray = (unsigned*)( sq + params.sq_off.array );
+		sqes = (struct io_uring_sqe*)sqeMap;
+
+		char *cq = (char*)cqMap;
+		cqHead = (unsigned*)( cq + params.cq_off.head );
+		cqTail = (unsigned*)( cq + params.cq_off.tail );
+		cqMask = *(unsigned*)( cq + params.cq_off.ring_mask );
+		cqes = (struct io_uring_cqe*)( cq + params.cq_off.cqes );
+	}
+	virtual ~IoRing(){
+		release();
+	}
+
+	IoRing(const IoRing &) = delete;
+	IoRing &operator=(const IoRing &) = delete;
+
+	/*
+		prepare
+
+		SQE 하나를 채운다. 실제로 커널에 넘기는 것은 submit이다.
+		SQ가 가득 찼으면 false를 반환한다. ( submit 후 다시 시도 )
+
+		opcode : IORING_OP_READ, IORING_OP_WRITE 등
+		offset : 파일 오프셋 ( -1이면 fd의 현재 위치, 소켓/파이프 )
+		userData : CQE로 돌려받을 값
+	*/
+	bool prepare(uint8_t opcode, int fd, const void *addr, uint32_t len,
+		     uint64_t offset, uint64_t userData){
+		unsigned tail = *sqTail;
+		if( tail - __atomic_load_n( sqHead, __ATOMIC_ACQUIRE ) >= sqEntries )
+			return false;
+
+		unsigned index = tail & sqMask;
+		struct io_uring_sqe *sqe = &sqes[index];
+
+		memset( sqe, 0, sizeof(*sqe) );
+		sqe->opcode = opcode;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)addr;
+		sqe->len = len;
+		sqe->off = offset;
+		sqe->user_data = userData;
+
+		sqArray[index] = index;
+		__atomic_store_n( sqTail, tail + 1, __ATOMIC_RELEASE );
+
+		nUnsubmitted ++;
+		return true;
+	}
+
+	/*
+		submit
+
+		준비된 SQE들을 커널에 넘기고, waitFor개의 CQE가 생길 때까지 기다린다.
+
+		반환값 : 0 또는 -errno ( EINTR은 0으로 본다. )
+	*/
+	int submit(unsigned waitFor = 0){
+		unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+		if( nUnsubmitted == 0 && waitFor == 0 )
+			return 0;
+
+		int n = (int)syscall( __NR_io_uring_enter, ringFd, nUnsubmitted, waitFor, flags, nullptr, 0 );
+		if( n < 0 )
+			return errno == EINTR ? 0 : -errno;
+
+		nUnsubmitted -= std::min( nUnsubmitted, (unsigned)n );
+		return 0;
+	}
+
+	/*
+		reap
+
+		완료된 CQE마다 onCompletion( userData, result )를 부른다.
+		result는 read/write의 반환값 또는 -errno이다.
+
+		반환값 : 꺼낸 CQE의 수
+	*/
+	template <typename F>
+	size_t reap(F &&onCompletion){
+		unsigned head = *cqHead;
+		size_t count = 0;
+
+		while( head != __atomic_load_n( cqTail, __ATOMIC_ACQUIRE ) ){
+			struct io_uring_cqe *cqe = &cqes[ head & cqMask ];
+			uint64_t userData = cqe->user_data;
+			int result = cqe->res;
+
+			head ++;
+			__atomic_store_n( cqHead, head, __ATOMIC_RELEASE );
+
+			onCompletion( userData, result );
+			count ++;
+		}
+		return count;
+	}
+
+	unsigned unsubmitted() const{
+		return nUnsubmitted;
+	}
+
+protected:
+	void *mapRegion(size_t size, off_t offset){
+		void *mem = mmap( nullptr, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ringFd, offset );
+		if( mem == MAP_FAILED ){
+			int error = errno;
+			release();
+			throw std::system_error( error, std::generic_category(), "IoRing : mmap" );
+		}
+		return mem;
+	}
+
+	void release(){
+		if( sqeMap != nullptr )
+			munmap( sqeMap, sqeMapSize );
+		if( cqMap != nullptr && cqMap != sqMap )
+			munmap( cqMap, cqMapSize );
+		if( sqMap != nullptr )
+			munmap( sqMap, sqMapSize );
+		if( ringFd >= 0 )
+			close( ringFd );
+
+		sqeMap = cqMap = sqMap = nullptr;
+		ringFd = -1;
+	}
+
+protected:
+	int ringFd;
+
+	void *sqMap;
+	void *cqMap;
+	void *sqeMap;
+	size_t sqMapSize;
+	size_t cqMapSize;
+	size_t sqeMapSize;
+
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned sqMask;
+	unsigned sqEntries;
+	unsigned *sqArray;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned cqMask;
+	struct io_uring_cqe *cqes;
+
+	unsigned nUnsubmitted;	// 채웠지만 아직 커널에 넘기지 않은 SQE의 수
+};
+
+/*
+	IoContext
+
+	worker 하나가 가지는 비동기 I/O 문맥. ( DynamicProcessPool의 I/O 모드 )
+
+	핸들러는 read/write를 부르며 완료 시 이어서 할 일( continuation )을 넘기고 바로 반환한다.
+	worker는 I/O가 끝나기를 기다리지 않고 다른 workItem을 처리하다가,
+	workItem 사이와 큐가 비었을 때 완료된 I/O의 continuation을 부른다.
+	continuation 안에서 다시 read/write를 불러 이어갈 수 있다.
+
+	버퍼는 continuation이 불릴 때까지 살아있어야 한다.
+	( std::shared_ptr 등으로 continuation에 같이 담는다. )
+
+	io_uring을 쓸 수 없으면 read/write는 pread/pwrite로 바로 수행되고
+	continuation만 나중에 불린다.
+
+	cancel을 부르면 진행 중인 I/O와 그 뒤에 거는 I/O는 모두 -ECANCELED로 끝난다.
+	( 취소가 닿기 전에 끝난 I/O는 원래 결과를 받는다. )
+	데이터가 오지 않는 소켓이나 파이프를 읽는 I/O도 drain이 기다리지 않게 된다.
+
+		[](Request req, IoContext &io){
+			auto buffer = std::make_shared<std::vector<char>>( req.size );
+			io.read( req.fd, buffer->data(), buffer->size(), req.offset,
+				[buffer](int result){ ... } );
+			return true;
+		}
+*/
+class IoContext{
+public:
+	// read/write의 반환값 또는 -errno를 받는다.
+	typedef std::function<void(int result)> completion_t;
+
+	/*
+		IoContext
+
+		entries : io_uring SQ의 크기
+	*/
+	IoContext(unsigned entries = 256) :
+		wakeFd( -1 ), wakeArmed( false ), wakeCount( 0 ),
+		cancelled( false ), cancelSubmitted( false ), nInflight( 0 ) {
+
+		try{
+			ring.reset( new IoRing( entries ) );
+		}
+		catch( std::system_error & ){
+			// io_uring을 쓸 수 없으면 동기 I/O로 대신한다.
+		}
+
+		// 동기 I/O에서도 cancel이 소켓/파이프를 기다리는 read/write를 깨우는 데 쓴다.
+		wakeFd = eventfd( 0, EFD_CLOEXEC );
+		if( wakeFd < 0 )
+			throw std::system_error( errno, std::generic_category(), "IoContext : eventfd" );
+	}
+	/*
+		~IoContext
+
+		남은 I/O는 취소하고 continuation을 모두 부른 뒤에 정리한다.
+	*/
+	virtual ~IoContext(){
+		cancel();
+		drain();
+
+		// 걸어둔 wakeFd 읽기를 끝내고 거둔다. ( wakeCount에 커널이 쓰지 않게 )
+		if( wakeArmed ){
+			wake();
+			while( wakeArmed && ring->submit( 1 ) == 0 )
+				reapCompletions();
+		}
+
+		ring.reset();
+		if( wakeFd >= 0 )
+			close( wakeFd );
+	}
+
+	IoContext(const IoContext &) = delete;
+	IoContext &operator=(const IoContext &) = delete;
+
+	/*
+		read
+
+		fd에서 읽고 완료되면 then( 읽은 바이트 또는 -errno )을 부른다.
+
+		offset : 파일 오프셋 ( -1이면 fd의 현재 위치, 소켓/파이프 )
+	*/
+	void read(int fd, void *buffer, size_t len, int64_t offset, completion_t then){
+		submit( IORING_OP_READ, fd, buffer, len, offset, std::move(then) );
+	}
+	/*
+		write
+
+		fd에 쓰고 완료되면 then( 쓴 바이트 또는 -errno )을 부른다.
+	*/
+	void write(int fd, const void *buffer, size_t len, int64_t offset, completion_t then){
+		submit( IORING_OP_WRITE, fd, buffer, len, offset, std::move(then) );
+	}
+
+	/*
+		pending
+
+		continuation이 아직 불리지 않은 I/O의 수
+	*/
+	size_t pending() const{
+		return nInflight + ready.size();
+	}
+	/*
+		usingRing
+
+		io_uring을 쓰는지 여부 ( false이면 동기 I/O로 대신하는 중 )
+	*/
+	bool usingRing() const{
+		return (bool)ring;
+	}
+
+	/*
+		poll
+
+		준비된 I/O를 커널에 넘기고, 기다리지 않고 완료된 continuation들을 부른다.
+		반환값 : 부른 continuation의 수
+	*/
+	size_t poll(){
+		if( ring ){
+			cancelInflight();
+			flush( 0 );
+		}
+		return runReady();
+	}
+	/*
+		wait
+
+		I/O 하나가 완료되거나 wake가 불릴 때까지 기다린 뒤 poll한다.
+	*/
+	size_t wait(){
+		if( ring )
+			cancelInflight();
+		if( ring && ready.empty() && nInflight > 0 ){
+			if( !wakeArmed && ring->prepare( IORING_OP_READ, wakeFd,
+					&wakeCount, sizeof(wakeCount), 0, wakeTag ) )
+				wakeArmed = true;
+
+			flush( 1 );
+		}
+		return poll();
+	}
+	/*
+		wake
+
+		wait 중인 쓰레드를 깨운다. 다른 쓰레드에서 불러도 된다.
+	*/
+	void wake(){
+		if( wakeFd >= 0 ){
+			uint64_t one = 1;
+			ssize_t n = ::write( wakeFd, &one, sizeof(one) );
+			(void)n;
+		}
+	}
+
+	/*
+		cancel
+
+		진행 중인 I/O를 모두 취소하고, 이후에 거는 I/O는 바로 -ECANCELED로 끝낸다.
+		다른 쓰레드에서 불러도 된다. io_uring에서는 이 IoContext를 쓰는 쓰레드가
+		다음 poll / wait / drain에서 IORING_OP_ASYNC_CANCEL을 넘긴다.
+	*/
+	void cancel(){
+		cancelled.store( true );
+		wake();
+	}
+
+	/*
+		drain
+
+		모든 I/O가 완료되고 continuation이 불릴 때까지 기다린다.
+		기다리는 중에 cancel이 불리면 남은 I/O를 취소하고 그 완료까지만 기다린다.
+	*/
+	void drain(){
+		while( pending() > 0 ){
+			if( ring ){
+				cancelInflight();
+
+				if( ready.empty() && nInflight > 0 ){
+					// cancel이 깨울 수 있도록 wakeFd 읽기를 같이 걸어둔다.
+					if( !wakeArmed && !cancelSubmitted && ring->prepare( IORING_OP_READ,
+							wakeFd, &wakeCount, sizeof(wakeCount), 0, wakeTag ) )
+						wakeArmed = true;
+					flush( 1 );
+				}
+			}
+			runReady();
+		}
+	}
+
+protected:
+	static constexpr uint64_t wakeTag = ~(uint64_t)0;
+	static constexpr uint64_t cancelTag = ~(uint64_t)1;
+
+	/*
+		cancelInflight
+
+		cancel이 불렸으면 진행 중인 I/O마다 IORING_OP_ASYNC_CANCEL을 한 번 넘긴다.
+	*/
+	void cancelInflight(){
+		if( cancelSubmitted || !cancelled.load() )
+			return;
+		cancelSubmitted = true;
+
+		std::vector<bool> idle( slots.size(), false );
+		for( uint32_t slot : freeSlots )
+			idle[slot] = true;
+
+		for( uint32_t slot=0;slot<slots.size();slot++ ){
+			if( idle[slot] )
+				continue;
+
+			while( !ring->prepare( IORING_OP_ASYNC_CANCEL, -1, (const void*)(uintptr_t)slot,
+					0, 0, cancelTag ) ){
+				if( flush( 0 ) != 0 )
+					return;
+			}
+		}
+		flush( 0 );
+	}
+
+	/*
+		waitStream
+
+		동기 I/O에서 소켓/파이프가 준비되거나 cancel이 불릴 때까지 기다린다.
+		cancel이 불렸으면 false를 반환한다.
+	*/
+	bool waitStream(int fd, short events){
+		struct pollfd fds[2] = { { fd, events, 0 }, { wakeFd, POLLIN, 0 } };
+
+		while( !cancelled.load() ){
+			if( ::poll( fds, 2, -1 ) < 0 ){
+				if( errno == EINTR )
+					continue;
+				return true;	// read/write가 에러를 돌려주게 한다.
+			}
+			if( fds[0].revents != 0 )
+				return true;
+			if( fds[1].revents & POLLIN ){
+				// cancel이 아닌 wake는 동기 I/O에서 쓰이지 않으므로 비우고 계속 기다린다.
+				uint64_t count;
+				ssize_t n = ::read( wakeFd, &count, sizeof(count) );
+				(void)n;
+			}
+		}
+		return false;
+	}
+
+	void submit(uint8_t opcode, int fd, const void *buffer, size_t len,
+		    int64_t offset, completion_t then){
+		if( cancelled.load() ){
+			ready.emplace_back( std::move(then), -ECANCELED );
+			return;
+		}
+
+		if( !ring ){
+			if( offset < 0 && !waitStream( fd, opcode == IORING_OP_READ ? POLLIN : POLLOUT ) ){
+				ready.emplace_back( std::move(then), -ECANCELED );
+				return;
+			}
+
+			ssize_t n = opcode == IORING_OP_READ ?
+				( offset < 0 ? ::read( fd, (void*)buffer, len ) : pread( fd, (void*)buffer, len, offset ) ) :
+				( offset < 0 ? ::write( fd, buffer, len ) : pwrite( fd, buffer, len, offset ) );
+
+			ready.emplace_back( std::move(then), n < 0 ? -errno : (int)n );
+			return;
+		}
+
+		uint32_t slot;
+		if( !freeSlots.empty() ){
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+			slots[slot] = std::move( then );
+		}
+		else{
+			slot = (uint32_t)slots.size();
+			slots.push_back( std::move(then) );
+		}
+
+		// SQ가 가득 찼으면 넘기고 다시 채운다.
+		uint32_t chunk = (uint32_t)std::min( len, (size_t)0x7ffff000 );
+		while( !ring->prepare( opcode, fd, buffer, chunk, (uint64_t)offset, slot ) ){
+			int error = flush( 0 );
+			if( error != 0 ){
+				complete( slot, error );
+				return;
+			}
+		}
+		nInflight ++;
+	}
+
+	/*
+		flush
+
+		SQE들을 넘기고 waitFor개를 기다린 뒤 CQE들을 ready로 옮긴다.
+		반환값 : 0 또는 -errno
+	*/
+	int flush(unsigned waitFor){
+		int error = ring->submit( waitFor );
+
+		// CQ가 넘쳐 넘길 수 없으면 CQE를 먼저 거두고 다시 넘긴다.
+		if( error == -EBUSY || error == -EAGAIN ){
+			reapCompletions();
+			error = ring->submit( 0 );
+		}
+
+		reapCompletions();
+		return error == -EBUSY || error == -EAGAIN ? 0 : error;
+	}
+
+	void reapCompletions(){
+		ring->reap( [this](uint64_t userData, int result){
+			if( userData == wakeTag ){
+				wakeArmed = false;
+				return;
+			}
+			if( userData == cancelTag )
+				return;
+
+			// io-wq에서 실행 중이던 I/O는 취소되면 -EINTR로 끝난다.
+			if( result == -EINTR && cancelSubmitted )
+				result = -ECANCELED;
+
+			nInflight --;
+			complete( (uint32_t)userData, result );
+		});
+	}
+
+	void complete(uint32_t slot, int result){
+		ready.emplace_back( std::move(slots[slot]), result );
+		slots[slot] = completion_t();
+		freeSlots.push_back( slot );
+	}
+
+	size_t runReady(){
+		size_t count = 0;
+
+		while( !ready.empty() ){
+			std::pair<completion_t, int> done = std::move( ready.front() );
+			ready.pop_front();
+
+			if( done.first )
+				done.first( done.second );
+			count ++;
+		}
+		return count;
+	}
+
+protected:
+	std::unique_ptr<IoRing> ring;	// 없으면 동기 I/O
+
+	int wakeFd;		// wait와 동기 I/O를 깨우는 eventfd
+	bool wakeArmed;		// wakeFd 읽기가 ring에 걸려 있는지
+	uint64_t wakeCount;	// wakeFd 읽기 버퍼
+
+	std::atomic<bool> cancelled;	// cancel이 불렸는지
+	bool cancelSubmitted;		// 진행 중인 I/O에 IORING_OP_ASYNC_CANCEL을 넘겼는지
+
+	std::vector<completion_t> slots;	// 진행 중인 I/O의 continuation ( userData가 index )
+	std::vector<uint32_t> freeSlots;
+	size_t nInflight;			// 커널에 넘긴 I/O의 수
+
+	std::deque<std::pair<completion_t, int> > ready;	// 완료되어 부를 continuation
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+/*
+	LatencySlo
+
+	enqueue에서 핸들러 시작까지의 대기 시간( queue wait )에 대한 목표와
+	그것을 지키기 위한 worker 수 조절기의 설정.
+
+	p99Target : 대기 시간 p99의 목표
+	minWorkers : worker 수의 하한 ( 1 이상 )
+	interval : 조절 주기 ( 한 주기 동안의 대기 시간으로 p99를 잰다. )
+	kp, ki : PI 조절기의 이득 ( 목표 대비 오차 1.0당 worker 수 )
+	maxStepUp : 한 주기에 늘릴 수 있는 worker 수
+	maxStepDown : 한 주기에 줄일 수 있는 worker 수
+*/
+struct LatencySlo{
+	std::chrono::microseconds p99Target;
+	int minWorkers;
+	std::chrono::milliseconds interval;
+	double kp;
+	double ki;
+	int maxStepUp;
+	int maxStepDown;
+
+	LatencySlo(std::chrono::microseconds _p99Target = std::chrono::microseconds( 1000 ),
+		   int _minWorkers = 1) :
+		p99Target( _p99Target ), minWorkers( _minWorkers ),
+		interval( 100 ), kp( 2.0 ), ki( 1.0 ),
+		maxStepUp( 4 ), maxStepDown( 1 ) {
+	}
+};
+
+/*
+	LatencyHistogram
+
+	대기 시간의 log 스케일 히스토그램. ( 2의 거듭제곱마다 subBuckets개의 칸, 상대 오차 약 1 / subBuckets )
+	record는 여러 쓰레드에서 동시에 불러도 되고 블록되지 않는다.
+*/
+class LatencyHistogram{
+public:
+	LatencyHistogram(){
+		clear();
+	}
+
+	void record(uint64_t nanos){
+		buckets[ bucketOf( nanos ) ].fetch_add( 1, std::memory_order_relaxed );
+	}
+
+	/*
+		percentile
+
+		q : 0 ~ 1 사이의 분위
+		반환값 : 분위에 해당하는 칸의 상한 ( ns, 표본이 없으면 0 )
+	*/
+	uint64_t percentile(double q, uint64_t *count = nullptr) const{
+		uint64_t total = 0;
+		for( auto &bucket : buckets )
+			total += bucket.load( std::memory_order_relaxed );
+
+		if( count != nullptr )
+			*count = total;
+		if( total == 0 )
+			return 0;
+
+		uint64_t rank = (uint64_t)std::ceil( q * total );
+		uint64_t seen = 0;
+		for( size_t i=0;i<nBuckets;i++ ){
+			seen += buckets[i].load( std::memory_order_relaxed );
+			if( seen >= rank && seen > 0 )
+				return upperBound( i );
+		}
+		return upperBound( nBuckets - 1 );
+	}
+
+	void clear(){
+		for( auto &bucket : buckets )
+			bucket.store( 0, std::memory_order_relaxed );
+	}
+
+protected:
+	static constexpr size_t subBits = 3;
+	static constexpr size_t subBuckets = 1 << subBits;
+	static constexpr size_t nBuckets = 64 * subBuckets;
+
+	static size_t bucketOf(uint64_t nanos){
+		if( nanos < subBuckets )
+			return (size_t)nanos;
+
+		size_t exponent = 63 - __builtin_clzll( nanos );
+		size_t sub = (size_t)( nanos >> ( exponent - subBits ) ) & ( subBuckets - 1 );
+
+		return std::min( ( exponent - subBits + 1 ) * subBuckets + sub, nBuckets - 1 );
+	}
+	static uint64_t upperBound(size_t index){
+		if( index < subBuckets )
+			return index;
+
+		size_t exponent = index / subBuckets + subBits - 1;
+		uint64_t sub = index % subBuckets;
+
+		return ( ( subBuckets + sub + 1 ) << ( exponent - subBits ) ) - 1;
+	}
+
+protected:
+	std::atomic<uint64_t> buckets[nBuckets];
+};
+
+/*
+	SloController
+
+	대기 시간 p99를 목표에 맞추도록 worker 수를 정하는 PI 조절기. ( velocity form )
+	오차는 ( p99 - 목표 ) / 목표로 정규화하고 [ -1, 4 ]로 자른다.
+	출력은 주기마다 maxStepUp / maxStepDown 이내로만 바뀌고 [ minWorkers, maxWorkers ]를 벗어나지 않는다.
+*/
+class SloController{
+public:
+	SloController() :
+		SloController( LatencySlo(), 1, 1 ) {
+	}
+	SloController(const LatencySlo &_slo, int _maxWorkers, int initialWorkers) :
+		slo( _slo ), maxWorkers( std::max( _maxWorkers, 1 ) ), lastError( 0 ) {
+
+		slo.minWorkers = std::min( std::max( slo.minWorkers, 1 ), maxWorkers );
+		desired = std::min( std::max( initialWorkers, slo.minWorkers ), maxWorkers );
+	}
+
+	/*
+		update
+
+		한 주기의 p99로 다음 worker 수를 정한다.
+
+		p99Nanos : 이번 주기의 대기 시간 p99 ( 표본이 없으면 0 )
+		backlog : 기다리는 workItem이 있는데 이번 주기에 시작한 workItem이 없었는지
+			( p99가 실제보다 낮게 잡혔을 수 있으므로 줄이지 않는다. )
+		반환값 : 목표 worker 수
+	*/
+	int update(uint64_t p99Nanos, bool backlog = false){
+		double target = (double)std::chrono::duration_cast<std::chrono::nanoseconds>( slo.p99Target ).count();
+		double error = target > 0 ? ( (double)p99Nanos - target ) / target : 0;
+
+		error = std::min( std::max( error, -1.0 ), 4.0 );
+
+		double step = slo.kp * ( error - lastError ) + slo.ki * error;
+		step = std::min( std::max( step, -(double)slo.maxStepDown ), (double)slo.maxStepUp );
+		if( backlog )
+			step = std::max( step, 0.0 );
+		lastError = error;
+
+		desired = std::min( std::max( desired + step, (double)slo.minWorkers ), (double)maxWorkers );
+		return workers();
+	}
+
+	int workers() const{
+		return (int)std::lround( desired );
+	}
+	const LatencySlo &policy() const{
+		return slo;
+	}
+
+protected:
+	LatencySlo slo;
+	int maxWorkers;
+
+	double desired;		// 목표 worker 수 ( 소수점까지 누적 )
+	double lastError;	// 지난 주기의 오차
+};
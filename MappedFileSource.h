@@ -0,0 +1,282 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <system_error>
+
+#include <atomic>
+#include <mutex>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+	MappedFileSource
+
+	큰 레코드 파일을 mmap하여 레코드 경계에 맞춘 chunk로 나누고,
+	worker들이 chunk를 직접 가져가 레코드를 std::string_view로 처리하게 하는 입력 어댑터.
+	레코드는 매핑을 가리키므로 복사되지 않는다. ( source가 살아있는 동안만 유효 )
+
+	레코드 경계는 구분자( 기본 '\n' ) 또는 framing 함수로 정한다.
+
+	구분자 : chunk i는 [ i * chunkSize, ( i + 1 ) * chunkSize ) 에서 시작하는 레코드들이다.
+	         각 worker가 경계 근처만 memchr로 찾으므로 chunk들을 서로 기다리지 않고 나눈다.
+	framing : 중간에서 레코드의 시작을 알 수 없으므로 경계는 chunk를 가져갈 때
+	         앞에서부터 차례로 정한다. ( 레코드 길이만 읽으므로 처리에 비해 짧다. )
+
+	DynamicProcessPool과 쓰는 법
+
+		MappedFileSource source( "records.log" );
+		DynamicProcessPool<MappedFileSource::token_t> pool( n, n, lifeTime,
+			source.chunkHandler( [](std::string_view record){ ...; return true; } ) );
+		source.enqueueChunks( pool );
+
+	큐에는 chunk 수만큼의 token만 들어가고, token을 받은 worker가 다음 chunk를 가져간다.
+*/
+class MappedFileSource{
+public:
+	typedef MappedFileSource *token_t;
+
+	// begin에서 시작하는 레코드의 길이를 반환한다. ( end를 넘거나 잘못되었으면 0 )
+	typedef std::function<size_t(const char *begin, const char *end)> framer_t;
+
+	/*
+		MappedFileSource
+
+		path : 읽을 파일
+		_chunkSize : chunk 하나의 대략적인 크기
+	*/
+	MappedFileSource(const std::string &path, size_t _chunkSize = 4 << 20) :
+		data( nullptr ), size( 0 ), chunkSize( _chunkSize > 0 ? _chunkSize : 1 ),
+		delimiter( '\n' ), nextIndex( 0 ), cursor( 0 ) {
+
+		int fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+		if( fd < 0 )
+			throw std::system_error( errno, std::generic_category(), "MappedFileSource : open" );
+
+		struct stat st;
+		if( fstat( fd, &st ) < 0 ){
+			int error = errno;
+			close( fd );
+			throw std::system_error( error, std::generic_category(), "MappedFileSource : fstat" );
+		}
+
+		size = (size_t)st.st_size;
+		if( size > 0 ){
+			void *mem = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+			if( mem == MAP_FAILED ){
+				int error = errno;
+				close( fd );
+				throw std::system_error( error, std::generic_category(), "MappedFileSource : mmap" );
+			}
+			data = (const char*)mem;
+		}
+		close( fd );
+	}
+	virtual ~MappedFileSource(){
+		if( data != nullptr )
+			munmap( (void*)data, size );
+	}
+
+	MappedFileSource(const MappedFileSource &) = delete;
+	MappedFileSource &operator=(const MappedFileSource &) = delete;
+
+	/*
+		setDelimiter
+
+		레코드를 구분자로 나눈다. 레코드에는 구분자가 포함되지 않는다.
+		chunk를 가져가기 시작하기 전에 호출해야 한다.
+	*/
+	void setDelimiter(char _delimiter){
+		delimiter = _delimiter;
+		framer = framer_t();
+	}
+	/*
+		setFraming
+
+		레코드를 framing 함수로 나눈다. ( 길이 접두 레코드 등 )
+		chunk를 가져가기 시작하기 전에 호출해야 한다.
+	*/
+	void setFraming(framer_t _framer){
+		framer = _framer;
+	}
+
+	/*
+		chunkCount
+
+		chunk 수의 상한 ( 레코드가 chunkSize보다 길면 실제로는 더 적다. )
+	*/
+	size_t chunkCount() const{
+		return ( size + chunkSize - 1 ) / chunkSize;
+	}
+
+	/*
+		nextChunk
+
+		다음 chunk를 가져간다. 여러 쓰레드에서 동시에 불러도 된다.
+		더 가져갈 chunk가 없으면 false를 반환한다.
+	*/
+	bool nextChunk(std::string_view &chunk){
+		if( framer )
+			return nextFramedChunk( chunk );
+
+		while( true ){
+			size_t index = nextIndex.fetch_add( 1 );
+			if( index >= chunkCount() )
+				return false;
+
+			size_t begin = recordStartFrom( index * chunkSize );
+			size_t end = recordStartFrom( ( index + 1 ) * chunkSize );
+
+			// chunkSize보다 긴 레코드가 chunk 전체를 덮으면 빈 chunk가 된다.
+			if( begin < end ){
+				chunk = std::string_view( data + begin, end - begin );
+				return true;
+			}
+		}
+	}
+
+	/*
+		forEachRecord
+
+		chunk 안의 레코드마다 onRecord( std::string_view )를 부른다.
+		반환값 : 레코드의 수
+	*/
+	template <typename F>
+	size_t forEachRecord(std::string_view chunk, F &&onRecord) const{
+		const char *p = chunk.data();
+		const char *end = p + chunk.size();
+		size_t count = 0;
+
+		if( framer ){
+			while( p < end ){
+				size_t len = framer( p, end );
+				if( len == 0 || len > (size_t)( end - p ) )
+					break;
+
+				onRecord( std::string_view( p, len ) );
+				p += len;
+				count ++;
+			}
+			return count;
+		}
+
+		while( p < end ){
+			const char *found = (const char*)memchr( p, delimiter, end - p );
+			const char *recordEnd = found != nullptr ? found : end;
+
+			onRecord( std::string_view( p, recordEnd - p ) );
+			count ++;
+
+			p = found != nullptr ? found + 1 : end;
+		}
+		return count;
+	}
+
+	/*
+		chunkHandler
+
+		DynamicProcessPool<token_t>의 핸들러를 만든다.
+		token 하나마다 chunk 하나를 가져가 그 안의 레코드마다 onRecord를 부른다.
+		onRecord가 하나라도 false를 반환하면 핸들러도 false를 반환한다.
+	*/
+	template <typename F>
+	std::function<bool(token_t)> chunkHandler(F onRecord){
+		return [onRecord](token_t source) mutable{
+			std::string_view chunk;
+			bool result = true;
+
+			if( !source->nextChunk( chunk ) )
+				return true;
+
+			source->forEachRecord( chunk, [&](std::string_view record){
+				if( !onRecord( record ) )
+					result = false;
+			});
+			return result;
+		};
+	}
+
+	/*
+		enqueueChunks
+
+		chunk 수만큼의 token을 풀에 한 번에 넣는다.
+		반환값 : 넣은 token의 수
+	*/
+	template <typename P>
+	size_t enqueueChunks(P &pool){
+		std::vector<token_t> tokens( chunkCount(), this );
+		size_t count = tokens.size();
+
+		pool.enqueueBulk( std::move(tokens) );
+		return count;
+	}
+
+protected:
+	/*
+		recordStartFrom
+
+		offset 이상에서 시작하는 첫 레코드의 위치. ( 없으면 size )
+	*/
+	size_t recordStartFrom(size_t offset) const{
+		if( offset == 0 )
+			return 0;
+		if( offset >= size )
+			return size;
+
+		const char *found = (const char*)memchr( data + offset - 1, delimiter, size - offset + 1 );
+		return found != nullptr ? (size_t)( found - data ) + 1 : size;
+	}
+
+	/*
+		nextFramedChunk
+
+		framing 함수로 앞에서부터 chunkSize 이상이 될 때까지 레코드를 묶는다.
+		framing 할 수 없는 꼬리는 버린다.
+	*/
+	bool nextFramedChunk(std::string_view &chunk){
+		std::unique_lock<std::mutex> guard( cursorMutex );
+
+		size_t begin = cursor;
+		size_t end = begin;
+
+		while( end < size && end - begin < chunkSize ){
+			size_t len = framer( data + end, data + size );
+			if( len == 0 || len > size - end ){
+				cursor = size;
+				break;
+			}
+			end += len;
+		}
+
+		if( end > cursor )
+			cursor = end;
+		if( begin == end )
+			return false;
+
+		chunk = std::string_view( data + begin, end - begin );
+		return true;
+	}
+
+protected:
+	const char *data;	// 파일 매핑
+	size_t size;
+	size_t chunkSize;
+
+	char delimiter;
+	framer_t framer;	// 없으면 delimiter로 나눈다.
+
+	std::atomic<size_t> nextIndex;	// 구분자 방식에서 다음에 가져갈 chunk 번호
+
+	size_t cursor;		// framing 방식에서 다음 chunk의 시작
+	std::mutex cursorMutex;
+};
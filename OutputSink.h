@@ -0,0 +1,362 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <string>
+#include <algorithm>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <type_traits>
+#include <system_error>
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "PoolCodec.h"
+#include "ShmRing.h"
+
+/*
+	OutputSink
+
+	worker들이 만든 결과를 모아 큰 writev로 fd( 파일, 소켓 )에 쓰는 출력 단계.
+	worker마다 뮤텍스를 잡고 작은 write를 부르는 대신, 결과를 lock-free MPSC 큐에
+	넣기만 하고 sink 쓰레드가 쌓인 결과를 한 번에 최대 IOV_MAX개씩 writev로 쓴다.
+
+	V가 std::string_view로 바뀌는 타입( std::string 등 )이면 그 바이트를 그대로 쓰고,
+	아니면 PoolCodec<V>로 직렬화하여 쓴다. 구분자 등은 V에 포함시켜야 한다.
+
+	ordered이면 push에 넘긴 일련번호( 0부터 빈틈없이 ) 순서대로 쓴다.
+	결과가 없는 일련번호는 skip으로 건너뛴다.
+
+	V : 결과의 타입
+*/
+template <typename V>
+class OutputSink{
+public:
+	/*
+		OutputSink
+
+		_fd : 결과를 쓸 fd ( 닫지 않는다 )
+		_ordered : 일련번호 순서대로 쓸지 여부
+	*/
+	OutputSink(int _fd, bool _ordered = false) :
+		fd( _fd ), ordered( _ordered ),
+		head( &stub ), tail( &stub ),
+		signal( 0 ), sleeping( 0 ),
+		nPushed( 0 ), nWritten( 0 ), nWriteCalls( 0 ),
+		writeError( 0 ), quit( false ) {
+
+		static_assert( std::is_convertible<const V&, std::string_view>::value ||
+			PoolCodec<V>::supported,
+			"OutputSink : result requires a string-like type or a PoolCodec<V> specialization" );
+
+		stub.next.store( nullptr );
+
+		sink = std::thread( &OutputSink::sinkthread, this );
+	}
+	virtual ~OutputSink(){
+		kill();
+	}
+
+	OutputSink(const OutputSink &) = delete;
+	OutputSink &operator=(const OutputSink &) = delete;
+
+	/*
+		push
+
+		결과를 쓰기 큐에 넣는다. 여러 쓰레드에서 동시에 불러도 되고 블록되지 않는다.
+
+		seq : ordered일 때 쓰는 순서 ( 아니면 무시 )
+		value : 쓸 결과
+	*/
+	void push(uint64_t seq, V value){
+		node_t *node = new node_t();
+
+		node->seq = seq;
+		node->skip = false;
+		node->value.emplace( std::move( value ) );
+		if constexpr( !std::is_convertible<const V&, std::string_view>::value ){
+			node->encoded.resize( PoolCodec<V>::encodedSize( *node->value ) );
+			PoolCodec<V>::encode( *node->value, &node->encoded[0] );
+		}
+
+		enqueue( node );
+	}
+	/*
+		skip
+
+		ordered일 때 결과가 없는 일련번호를 건너뛴다. ( 핸들러가 실패한 workItem 등 )
+	*/
+	void skip(uint64_t seq){
+		if( !ordered )
+			return;
+
+		node_t *node = new node_t();
+		node->seq = seq;
+		node->skip = true;
+
+		enqueue( node );
+	}
+
+	/*
+		flush
+
+		지금까지 push된 결과가 모두 쓰일 때까지 기다린다.
+		ordered에서 앞선 일련번호가 빠져 있으면 그것이 올 때까지 기다린다.
+		쓰기에 실패한 적이 있으면 std::system_error를 던진다.
+	*/
+	void flush(){
+		uint64_t target = nPushed.load();
+		std::unique_lock<std::mutex> guard( flushMutex );
+
+		flushSignal.wait( guard, [&](){
+			return nWritten.load() >= target || writeError.load() != 0 || quit.load();
+		});
+
+		if( writeError.load() != 0 )
+			throw std::system_error( writeError.load(), std::generic_category(), "OutputSink : writev" );
+	}
+
+	/*
+		queryStatus
+
+		written : 쓴 결과의 수를 받아올 포인터
+		writeCalls : writev를 부른 횟수를 받아올 포인터
+	*/
+	void queryStatus(size_t *written,size_t *writeCalls){
+		if( written != nullptr )
+			*written = nWritten.load();
+		if( writeCalls != nullptr )
+			*writeCalls = nWriteCalls.load();
+	}
+
+	/*
+		kill
+
+		큐에 남은 결과를 모두 쓰고 sink 쓰레드를 끝낸다.
+	*/
+	void kill(){
+		if( quit.exchange( true ) )
+			return;
+
+		wake();
+		sink.join();
+
+		flushSignal.notify_all();
+	}
+
+protected:
+	struct node_t{
+		std::atomic<node_t*> next;
+		uint64_t seq;
+		bool skip;		// 쓸 것 없이 일련번호만 채운다.
+		std::optional<V> value;	// stub과 skip 노드는 비어 있다. ( V에 기본 생성자가 없어도 된다 )
+		std::string encoded;	// PoolCodec<V>로 직렬화한 바이트
+	};
+
+	/*
+		enqueue / dequeue
+
+		Vyukov의 intrusive MPSC 큐.
+		producer는 head를 exchange 한 번으로 넣고, sink 쓰레드만 tail에서 꺼낸다.
+	*/
+	void enqueue(node_t *node){
+		link( node );
+
+		nPushed.fetch_add( 1 );
+
+		if( sleeping.load() )
+			wake();
+	}
+	void link(node_t *node){
+		node->next.store( nullptr, std::memory_order_relaxed );
+
+		node_t *prev = head.exchange( node, std::memory_order_acq_rel );
+
+		// sink는 sleeping을 세운 뒤 next를 확인하고, producer는 next를 쓴 뒤 sleeping을 확인한다.
+		// 양쪽 모두 seq_cst여야 서로의 쓰기를 동시에 놓치지 않는다. ( release면 sink가 깨우기를 놓치고 잠든다 )
+		prev->next.store( node, std::memory_order_seq_cst );
+	}
+	node_t *dequeue(){
+		node_t *first = tail;
+		node_t *next = first->next.load( std::memory_order_acquire );
+
+		if( first == &stub ){
+			if( next == nullptr )
+				return nullptr;
+
+			tail = next;
+			first = next;
+			next = next->next.load( std::memory_order_acquire );
+		}
+
+		if( next != nullptr ){
+			tail = next;
+			return first;
+		}
+
+		// first가 마지막이면 stub을 뒤에 붙여야 꺼낼 수 있다.
+		if( first != head.load( std::memory_order_acquire ) )
+			return nullptr;	// producer가 넣는 중
+
+		link( &stub );
+
+		next = first->next.load( std::memory_order_acquire );
+		if( next != nullptr ){
+			tail = next;
+			return first;
+		}
+		return nullptr;
+	}
+
+	void wake(){
+		signal.fetch_add( 1 );
+		futexWake( &signal, 1 );
+	}
+
+	static std::string_view bytesOf(const node_t *node){
+		if constexpr( std::is_convertible<const V&, std::string_view>::value )
+			return std::string_view( *node->value );
+		else
+			return std::string_view( node->encoded );
+	}
+
+	/*
+		sinkthread
+
+		큐에 쌓인 결과를 꺼내 writev로 쓰는 쓰레드
+	*/
+	void sinkthread(){
+		std::vector<node_t*> batch;
+		std::unordered_map<uint64_t, node_t*> reorder;	// ordered에서 순서를 기다리는 결과
+		uint64_t nextSeq = 0;
+
+		while( true ){
+			uint32_t ticket = signal.load();
+			node_t *node;
+			size_t drained = 0;
+
+			while( batch.size() < (size_t)IOV_MAX && ( node = dequeue() ) != nullptr ){
+				drained ++;
+
+				if( !ordered ){
+					batch.push_back( node );
+					continue;
+				}
+
+				reorder[ node->seq ] = node;
+				for( auto it = reorder.find( nextSeq ); it != reorder.end();
+					it = reorder.find( nextSeq ) ){
+					batch.push_back( it->second );
+					reorder.erase( it );
+					nextSeq ++;
+				}
+			}
+
+			if( !batch.empty() ){
+				writeBatch( batch );
+				batch.clear();
+				continue;
+			}
+			if( drained > 0 )
+				continue;
+
+			if( quit.load() && head.load() == tail )
+				break;
+
+			// 잠들기 전에 sleeping을 세우고 한 번 더 확인한다. ( 둘 다 seq_cst, link 참고 )
+			sleeping.store( 1 );
+			if( tail->next.load() == nullptr && !quit.load() )
+				futexWait( &signal, ticket );
+			sleeping.store( 0 );
+		}
+
+		for( auto &pending : reorder )
+			delete pending.second;
+	}
+
+	/*
+		writeBatch
+
+		batch의 결과들을 writev로 쓰고 노드를 지운다. 일부만 쓰였으면 나머지를 이어서 쓴다.
+	*/
+	void writeBatch(std::vector<node_t*> &batch){
+		std::vector<struct iovec> iov;
+
+		iov.reserve( batch.size() );
+		for( node_t *node : batch ){
+			if( node->skip )
+				continue;
+
+			std::string_view bytes = bytesOf( node );
+			if( !bytes.empty() )
+				iov.push_back( { (void*)bytes.data(), bytes.size() } );
+		}
+
+		size_t index = 0;
+		while( index < iov.size() && writeError.load() == 0 ){
+			ssize_t n = writev( fd, iov.data() + index,
+				(int)std::min( iov.size() - index, (size_t)IOV_MAX ) );
+			nWriteCalls.fetch_add( 1 );
+
+			if( n < 0 ){
+				if( errno == EINTR )
+					continue;
+				writeError.store( errno );
+				break;
+			}
+
+			size_t written = (size_t)n;
+			while( index < iov.size() && written >= iov[index].iov_len ){
+				written -= iov[index].iov_len;
+				index ++;
+			}
+			if( index < iov.size() ){
+				iov[index].iov_base = (char*)iov[index].iov_base + written;
+				iov[index].iov_len -= written;
+			}
+		}
+
+		for( node_t *node : batch )
+			delete node;
+
+		nWritten.fetch_add( batch.size() );
+		{
+			std::unique_lock<std::mutex> guard( flushMutex );
+		}
+		flushSignal.notify_all();
+	}
+
+protected:
+	int fd;
+	bool ordered;
+
+	node_t stub;			// MPSC 큐의 빈 노드
+	std::atomic<node_t*> head;	// producer들이 넣는 쪽
+	node_t *tail;			// sink 쓰레드가 꺼내는 쪽
+
+	std::atomic<uint32_t> signal;	// push가 sink 쓰레드를 깨울 때마다 증가 ( futex )
+	std::atomic<uint32_t> sleeping;	// sink 쓰레드가 잠들려는 중이면 1
+
+	std::atomic<uint64_t> nPushed;
+	std::atomic<uint64_t> nWritten;
+	std::atomic<uint64_t> nWriteCalls;
+	std::atomic<int> writeError;	// 처음 실패한 writev의 errno
+
+	std::mutex flushMutex;
+	std::condition_variable flushSignal;
+
+	std::thread sink;
+	std::atomic<bool> quit;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/*
+	PoolCodec
+
+	workItem을 바이트열로 직렬화하기 위한 customization point.
+	디스크 spill, 프로세스 worker 등 workItem이 메모리 밖으로 나가는 경로에서 사용된다.
+
+	특수화는 아래 멤버들을 제공해야 한다.
+
+		static constexpr bool supported = true;
+		static size_t encodedSize(const T &item);
+		static void encode(const T &item, void *dst);	// encodedSize 바이트를 쓴다
+		static T decode(const void *src, size_t len);
+
+	바이트열을 복사 없이 그 자리에서 읽을 수 있는 flat한 타입은 아래도 제공한다.
+	view_t를 받는 핸들러는 decode 대신 view로 workItem을 받는다.
+	view는 src가 살아있는 동안만 유효하다. ( src는 16바이트 정렬 )
+
+		typedef ... view_t;
+		static view_t view(const void *src, size_t len);
+
+	소켓처럼 믿을 수 없는 곳에서 온 바이트열을 받는 경우를 위해,
+	len이 올바른 인코딩의 길이인지 확인하는 함수도 제공할 수 있다. ( PoolCodecCheck 참고 )
+	SocketFrontend, PoolFederation, SharedPoolServer는 이것이 있어야 컴파일된다.
+
+		static bool valid(const void *src, size_t len);
+*/
+template <typename T, typename Enable = void>
+struct PoolCodec{
+	static constexpr bool supported = false;
+};
+
+/*
+	trivially copyable 타입은 메모리를 그대로 복사한다.
+*/
+template <typename T>
+struct PoolCodec<T,
+	typename std::enable_if<std::is_trivially_copyable<T>::value>::type>{
+	static constexpr bool supported = true;
+
+	static size_t encodedSize(const T &){
+		return sizeof(T);
+	}
+	static void encode(const T &item, void *dst){
+		memcpy( dst, &item, sizeof(T) );
+	}
+	static T decode(const void *src, size_t){
+		T item;
+		memcpy( &item, src, sizeof(T) );
+		return item;
+	}
+	static bool valid(const void *, size_t len){
+		return len == sizeof(T);
+	}
+
+	typedef const T &view_t;
+	static view_t view(const void *src, size_t){
+		return *(const T*)src;
+	}
+};
+
+/*
+	std::string은 내용 바이트만 기록한다.
+*/
+template <>
+struct PoolCodec<std::string>{
+	static constexpr bool supported = true;
+
+	static size_t encodedSize(const std::string &item){
+		return item.size();
+	}
+	static void encode(const std::string &item, void *dst){
+		memcpy( dst, item.data(), item.size() );
+	}
+	static std::string decode(const void *src, size_t len){
+		return std::string( (const char*)src, len );
+	}
+	static bool valid(const void *, size_t){
+		return true;
+	}
+
+	typedef std::string_view view_t;
+	static view_t view(const void *src, size_t len){
+		return std::string_view( (const char*)src, len );
+	}
+};
+
+/*
+	PoolCodecView
+
+	PoolCodec<T>가 view를 제공하는지와 그 타입.
+	( 제공하지 않으면 supported가 false이고 type은 void )
+*/
+template <typename T, typename = void>
+struct PoolCodecView{
+	static constexpr bool supported = false;
+	typedef void type;
+};
+template <typename T>
+struct PoolCodecView<T, std::void_t<typename PoolCodec<T>::view_t> >{
+	static constexpr bool supported = true;
+	typedef typename PoolCodec<T>::view_t type;
+};
+
+/*
+	PoolCodecCheck
+
+	믿을 수 없는 바이트열을 decode하기 전에 길이를 확인한다.
+	PoolCodec<T>가 valid를 제공해야 쓸 수 있고, 제공하지 않으면 checked가 false이다.
+	검사 없이 decode하는 대체 경로는 두지 않으므로 바이트열을 받는 쪽은
+	checked를 static_assert로 확인한다.
+*/
+template <typename T, typename = void>
+struct PoolCodecCheck{
+	static constexpr bool checked = false;
+};
+template <typename T>
+struct PoolCodecCheck<T, std::void_t<decltype( PoolCodec<T>::valid( nullptr, 0 ) )> >{
+	static constexpr bool checked = true;
+
+	static bool valid(const void *src, size_t len){
+		return PoolCodec<T>::valid( src, len );
+	}
+	/*
+		tryDecode
+
+		len이 올바른 인코딩이면 item에 decode하고 true, 아니면 false를 반환한다.
+	*/
+	static bool tryDecode(const void *src, size_t len, T *item){
+		if( !PoolCodec<T>::valid( src, len ) )
+			return false;
+
+		*item = PoolCodec<T>::decode( src, len );
+		return true;
+	}
+};
@@ -0,0 +1,789 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "PoolCodec.h"
+#include "DynamicProcessPool.h"
+
+/*
+	PoolFederation
+
+	여러 호스트( 또는 같은 호스트의 여러 프로세스 )의 DynamicProcessPool을 TCP로 묶는다.
+
+	각 노드는 gossipInterval마다 연결된 모든 노드에게 자신의 큐 길이를 알린다.
+	놀고 있는 worker가 있는 노드는 자신보다 stealThreshold 이상 밀린 노드를 보면
+	그 차이의 절반( 최대 stealBatch개 )을 달라고 요청하고,
+	요청받은 노드는 큐에서 가장 오래 기다린 workItem들을 PoolCodec<T>로 직렬화하여 보낸다.
+	받은 workItem은 enqueueBulk로 로컬 풀에 넣고 ack를 돌려준다.
+
+	넘겨준 workItem은 ack를 받을 때까지 넘겨준 노드가 들고 있다가
+	ack 전에 연결이 끊기면 로컬 풀에 다시 넣는다. 저널이 있는 풀에서는
+	ack를 받은 뒤에야 저널에서 완료로 기록한다.
+	따라서 가져간 노드가 넣은 뒤 ack가 오기 전에 연결이 끊기면 양쪽에서
+	한 번씩 처리될 수 있다. ( at-least-once )
+	workItem의 결과는 가져간 노드에서 처리되고 돌아오지 않으며,
+	ack 뒤에 가져간 노드가 처리 전에 죽으면 그 workItem은 잃는다.
+
+	각 노드는 임의의 node id를 가지고 연결마다 먼저 hello로 알린다.
+	두 노드가 서로를 addPeer하여 연결이 둘 생기면 양쪽 모두
+	id가 작은 노드가 연 연결만 남기고 다른 하나는 끊는다.
+
+	메시지는 같은 아키텍처끼리의 native byte order이다.
+
+		[ u32 type ][ u32 count ][ u64 body 길이 ][ body ]
+
+		hello : body = u64 node id ( 연결의 첫 메시지 )
+		depth : count = 큐 길이
+		steal : count = 원하는 workItem의 수
+		items : count = workItem의 수, body = ( [ u32 길이 ][ payload ] ) * count
+		ack : count = 받아서 넣은 workItem의 수 ( items 하나에 하나, 0개면 보내지 않는다 )
+
+	T, H, S : 묶을 DynamicProcessPool의 템플릿 인자
+*/
+template <typename T, typename H = std::function<bool(T)>,
+	  typename S = NoWorkerState>
+class PoolFederation{
+public:
+	typedef DynamicProcessPool<T, H, S>	pool_t;
+
+	/*
+		PoolFederation
+
+		_pool : 묶을 로컬 풀 ( 이 객체보다 오래 살아야 한다 )
+		_port : 다른 노드의 연결을 받을 TCP 포트 ( 0이면 임의의 포트, port()로 얻는다 )
+		_bindAddress : 연결을 받을 주소
+	*/
+	PoolFederation( pool_t &_pool, uint16_t _port = 0,
+			const std::string &_bindAddress = "127.0.0.1" ) :
+		pool( _pool ),
+		nodeId( randomNodeId() ),
+		gossipInterval( 20 ), stealThreshold( 4 ), stealBatch( 64 ),
+		nStolen( 0 ), nGiven( 0 ), quit( false ) {
+
+		static_assert( PoolCodec<T>::supported,
+			"PoolFederation : workItem requires a PoolCodec<T> specialization" );
+		static_assert( PoolCodecCheck<T>::checked,
+			"PoolFederation : stolen items come from peers, so PoolCodec<T> must provide valid()" );
+
+		listenSocket = openListener( _bindAddress, _port, &listenPort );
+
+		wakeEvent = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+		if( wakeEvent < 0 ){
+			int error = errno;
+			close( listenSocket );
+			throw std::system_error( error, std::generic_category(), "PoolFederation : eventfd" );
+		}
+
+		io = std::thread( &PoolFederation::iothread, this );
+	}
+	virtual ~PoolFederation(){
+		kill();
+
+		close( wakeEvent );
+		close( listenSocket );
+	}
+
+	PoolFederation(const PoolFederation &) = delete;
+	PoolFederation &operator=(const PoolFederation &) = delete;
+
+	/*
+		port
+
+		연결을 받는 TCP 포트
+	*/
+	uint16_t port() const{
+		return listenPort;
+	}
+
+	/*
+		addPeer
+
+		다른 노드를 추가한다. 연결이 끊기면 다음 gossip 때 다시 연결한다.
+		주소는 호출한 쓰레드에서 한 번만 찾으며, 찾지 못하면 std::runtime_error를 던진다.
+	*/
+	void addPeer(const std::string &host, uint16_t port){
+		peer_t peer;
+
+		peer.addr = resolve( host, port );
+		peer.remoteId = 0;
+		peer.connected = false;
+		peer.redundant = false;
+		{
+			std::unique_lock<std::mutex> guard( peerMutex );
+			peers.push_back( peer );
+		}
+		wake();
+	}
+
+	/*
+		setStealPolicy
+
+		_stealThreshold : 상대의 큐가 로컬보다 이만큼 이상 길면 가져온다.
+		_stealBatch : 한 번에 가져올 workItem의 최대 수
+		_gossipInterval : 큐 길이를 알리는 주기
+	*/
+	void setStealPolicy(size_t _stealThreshold, size_t _stealBatch,
+			    std::chrono::milliseconds _gossipInterval = std::chrono::milliseconds( 20 )){
+		stealThreshold.store( std::max( _stealThreshold, (size_t)1 ) );
+		stealBatch.store( std::max( _stealBatch, (size_t)1 ) );
+		gossipInterval.store( (int)_gossipInterval.count() );
+	}
+
+	/*
+		queryFederationStatus
+
+		stolen : 다른 노드에서 가져온 workItem의 수를 받아올 포인터
+		given : 다른 노드에게 넘겨주고 ack를 받은 workItem의 수를 받아올 포인터
+	*/
+	void queryFederationStatus(size_t *stolen,size_t *given){
+		if( stolen != nullptr )
+			*stolen = nStolen.load();
+		if( given != nullptr )
+			*given = nGiven.load();
+	}
+
+	/*
+		kill
+
+		모든 연결을 끊는다. 로컬 풀은 그대로 두고, ack를 받지 못한 workItem은 다시 넣는다.
+	*/
+	void kill(){
+		if( quit.exchange( true ) )
+			return;
+
+		wake();
+		io.join();
+
+		while( !connections.empty() )
+			closeConnection( connections.begin() );
+	}
+
+protected:
+	enum messageType{
+		messageDepth = 1,
+		messageSteal = 2,
+		messageItems = 3,
+		messageHello = 4,
+		messageAck = 5,
+	};
+
+	struct header_t{
+		uint32_t type;
+		uint32_t count;
+		uint64_t length;	// body의 길이
+	};
+
+	struct peer_t{
+		struct sockaddr_in addr;	// addPeer에서 찾아둔 주소
+		uint64_t remoteId;	// 마지막으로 연결했을 때 받은 node id ( 모르면 0 )
+		bool connected;		// 나가는 연결이 살아있는지
+		bool redundant;		// 같은 노드와 다른 연결이 있어 연결하지 않는다
+	};
+
+	// 넘겨주고 ack를 기다리는 workItem들 ( items 메시지 하나 )
+	struct given_t{
+		std::vector<T> items;
+		std::vector<uint64_t> journalIds;	// ack를 받으면 완료로 기록할 저널 레코드
+	};
+
+	struct connection_t{
+		int fd;
+		int peer;		// 나가는 연결이면 peers의 번호, 받은 연결이면 -1
+		uint64_t remoteId;	// hello로 받은 상대의 node id ( 받기 전에는 0 )
+		std::vector<char> input;	// 아직 메시지가 되지 못한 입력
+		std::vector<char> output;	// 아직 보내지 못한 출력
+		std::list<given_t> given;	// 보낸 순서대로 ack를 기다리는 workItem들
+		size_t remoteDepth;	// 상대가 마지막으로 알린 큐 길이
+		bool stealPending;	// 보낸 steal 요청의 응답을 기다리는 중
+		bool dropped;		// 같은 노드와의 중복 연결이라 끊을 연결
+	};
+
+	static const size_t readChunk = 64 * 1024;
+	static const uint64_t maxMessage = (uint64_t)1 << 30;
+
+	/*
+		openListener
+
+		address:port에 논블로킹 TCP listen 소켓을 열고 실제 포트를 boundPort에 넣는다.
+	*/
+	static int openListener(const std::string &address, uint16_t port, uint16_t *boundPort){
+		struct sockaddr_in addr;
+
+		memset( &addr, 0, sizeof(addr) );
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons( port );
+		if( inet_pton( AF_INET, address.c_str(), &addr.sin_addr ) != 1 )
+			throw std::invalid_argument( "PoolFederation : invalid bind address" );
+
+		int fd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+		if( fd < 0 )
+			throw std::system_error( errno, std::generic_category(), "PoolFederation : socket" );
+
+		int one = 1;
+		setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+
+		socklen_t len = sizeof(addr);
+		if( bind( fd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 ||
+			listen( fd, SOMAXCONN ) < 0 ||
+			getsockname( fd, (struct sockaddr*)&addr, &len ) < 0 ){
+			int error = errno;
+			close( fd );
+			throw std::system_error( error, std::generic_category(), "PoolFederation : bind" );
+		}
+
+		*boundPort = ntohs( addr.sin_port );
+		return fd;
+	}
+
+	/*
+		resolve
+
+		host:port의 IPv4 주소를 찾는다. 찾지 못하면 std::runtime_error를 던진다.
+	*/
+	static struct sockaddr_in resolve(const std::string &host, uint16_t port){
+		struct addrinfo hints, *result = nullptr;
+		struct sockaddr_in addr;
+
+		memset( &hints, 0, sizeof(hints) );
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+
+		int error = getaddrinfo( host.c_str(), std::to_string( port ).c_str(),
+			&hints, &result );
+		if( error != 0 )
+			throw std::runtime_error( "PoolFederation : cannot resolve " + host +
+				" : " + gai_strerror( error ) );
+
+		memcpy( &addr, result->ai_addr, sizeof(addr) );
+		freeaddrinfo( result );
+		return addr;
+	}
+
+	/*
+		connectPeer
+
+		addr로 논블로킹 연결을 시작한다. 실패하면 -1을 반환한다.
+	*/
+	static int connectPeer(const struct sockaddr_in &addr){
+		int fd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+		if( fd < 0 )
+			return -1;
+
+		if( connect( fd, (const struct sockaddr*)&addr, sizeof(addr) ) < 0 &&
+			errno != EINPROGRESS ){
+			close( fd );
+			return -1;
+		}
+
+		int one = 1;
+		setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+		return fd;
+	}
+
+	static uint64_t randomNodeId(){
+		std::random_device device;
+		uint64_t id = 0;
+
+		while( id == 0 )
+			id = ( (uint64_t)device() << 32 ) ^ device();
+		return id;
+	}
+
+	void wake(){
+		uint64_t one = 1;
+
+		if( write( wakeEvent, &one, sizeof(one) ) < 0 ){
+			// 이미 신호가 쌓여 있으면 실패해도 된다.
+		}
+	}
+
+	/*
+		iothread
+
+		연결을 관리하고 gossip과 steal을 주고받는 쓰레드
+	*/
+	void iothread(){
+		auto nextGossip = std::chrono::steady_clock::now();
+		std::vector<struct pollfd> fds;
+
+		while( !quit.load() ){
+			auto now = std::chrono::steady_clock::now();
+
+			if( now >= nextGossip ){
+				connectPeers();
+				gossip();
+				nextGossip = now + std::chrono::milliseconds( gossipInterval.load() );
+			}
+
+			fds.clear();
+			fds.push_back( { wakeEvent, POLLIN, 0 } );
+			fds.push_back( { listenSocket, POLLIN, 0 } );
+			for( auto &connection : connections ){
+				short events = POLLIN;
+				if( !connection.output.empty() )
+					events |= POLLOUT;
+				fds.push_back( { connection.fd, events, 0 } );
+			}
+
+			int timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+				nextGossip - std::chrono::steady_clock::now() ).count();
+			if( poll( fds.data(), fds.size(), std::max( timeout, 0 ) ) < 0 && errno != EINTR )
+				break;
+
+			if( fds[0].revents & POLLIN ){
+				uint64_t count;
+				if( read( wakeEvent, &count, sizeof(count) ) < 0 ){
+					// 논블로킹이므로 이미 비어있으면 실패한다.
+				}
+				nextGossip = std::chrono::steady_clock::now();
+			}
+			if( fds[1].revents & POLLIN )
+				acceptConnections();
+
+			// poll에 넣은 연결만 검사한다. ( 그 뒤에 추가된 연결은 다음 바퀴에 )
+			size_t i = 2;
+			for( auto it = connections.begin(); it != connections.end() && i < fds.size(); i++ ){
+				// 다른 연결의 hello로 dropped가 되었으면 더 읽지 않고 끊는다.
+				bool open = !it->dropped;
+
+				if( open && ( fds[i].revents & ( POLLIN | POLLHUP | POLLERR ) ) )
+					open = readMessages( *it );
+				if( open )
+					open = flush( *it );
+
+				if( open && !it->dropped )
+					++ it;
+				else
+					it = closeConnection( it );
+			}
+		}
+	}
+
+	/*
+		connectPeers
+
+		나가는 연결이 없는 peer들에 연결한다.
+		connect는 논블로킹이지만 peerMutex는 연결할 목록을 복사하는 동안만 잡는다.
+	*/
+	void connectPeers(){
+		std::vector<std::pair<int, struct sockaddr_in> > targets;
+		{
+			std::unique_lock<std::mutex> guard( peerMutex );
+
+			for( size_t i=0;i<peers.size();i++ ){
+				if( !peers[i].connected && !peers[i].redundant )
+					targets.push_back( { (int)i, peers[i].addr } );
+			}
+		}
+
+		for( auto &target : targets ){
+			int fd = connectPeer( target.second );
+			if( fd < 0 )
+				continue;
+
+			{
+				std::unique_lock<std::mutex> guard( peerMutex );
+				peers[ target.first ].connected = true;
+			}
+			openConnection( fd, target.first );
+		}
+	}
+
+	void acceptConnections(){
+		int fd;
+
+		while( ( fd = accept4( listenSocket, nullptr, nullptr,
+			SOCK_NONBLOCK | SOCK_CLOEXEC ) ) >= 0 ){
+			int one = 1;
+			setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+
+			openConnection( fd, -1 );
+		}
+	}
+
+	/*
+		openConnection
+
+		연결을 목록에 넣고 첫 메시지로 hello를 보낸다.
+	*/
+	void openConnection(int fd, int peer){
+		connection_t connection;
+
+		connection.fd = fd;
+		connection.peer = peer;
+		connection.remoteId = 0;
+		connection.remoteDepth = 0;
+		connection.stealPending = false;
+		connection.dropped = false;
+		send( connection, messageHello, 0, (const char*)&nodeId, sizeof(nodeId) );
+
+		connections.push_back( std::move(connection) );
+	}
+
+	/*
+		closeConnection
+
+		연결을 끊고 ack를 받지 못한 workItem들을 로컬 풀에 다시 넣는다.
+		다시 넣은 workItem은 새 저널 레코드를 가지므로 예전 레코드는 완료로 기록한다.
+	*/
+	typename std::list<connection_t>::iterator
+	closeConnection(typename std::list<connection_t>::iterator it){
+		// 상대가 기다리는 ack가 남아 있으면 보내본다.
+		flush( *it );
+
+		for( auto &batch : it->given ){
+			pool.enqueueBulk( std::move(batch.items) );
+			pool.completeStolen( batch.journalIds );
+		}
+
+		{
+			std::unique_lock<std::mutex> guard( peerMutex );
+
+			if( it->peer >= 0 )
+				peers[ it->peer ].connected = false;
+			// 남겨둔 연결이 끊기면 중복이라 쉬던 peer들이 다시 연결한다.
+			if( it->remoteId != 0 && !it->dropped ){
+				for( size_t i=0;i<peers.size();i++ )
+					if( peers[i].remoteId == it->remoteId )
+						peers[i].redundant = false;
+			}
+		}
+
+		close( it->fd );
+		return connections.erase( it );
+	}
+
+	/*
+		gossip
+
+		hello를 주고받은 모든 연결에 로컬 큐 길이를 알린다.
+	*/
+	void gossip(){
+		size_t depth = pool.queryQueueDepth();
+
+		for( auto &connection : connections ){
+			if( connection.remoteId == 0 || connection.dropped )
+				continue;
+			send( connection, messageDepth, (uint32_t)std::min( depth, (size_t)UINT32_MAX ),
+				nullptr, 0 );
+		}
+	}
+
+	void send(connection_t &connection, uint32_t type, uint32_t count,
+		  const char *body, size_t length){
+		header_t header = { type, count, length };
+		const char *p = (const char*)&header;
+
+		connection.output.insert( connection.output.end(), p, p + sizeof(header) );
+		if( length > 0 )
+			connection.output.insert( connection.output.end(), body, body + length );
+	}
+
+	/*
+		flush
+
+		보내지 못한 출력을 보낸다. 연결에 문제가 있으면 false를 반환한다.
+	*/
+	bool flush(connection_t &connection){
+		while( !connection.output.empty() ){
+			ssize_t n = ::send( connection.fd, connection.output.data(),
+				connection.output.size(), MSG_NOSIGNAL );
+
+			if( n < 0 ){
+				if( errno == EINTR )
+					continue;
+				// 연결 중이거나 버퍼가 가득 차면 POLLOUT을 기다린다.
+				return errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN;
+			}
+			connection.output.erase( connection.output.begin(),
+				connection.output.begin() + n );
+		}
+		return true;
+	}
+
+	/*
+		readMessages
+
+		읽을 수 있는 만큼 읽고 완성된 메시지들을 처리한다.
+		연결이 닫혔거나 메시지가 잘못되었으면 false를 반환한다.
+	*/
+	bool readMessages(connection_t &connection){
+		std::vector<char> &input = connection.input;
+		bool open = true;
+
+		while( true ){
+			size_t used = input.size();
+			input.resize( used + readChunk );
+
+			ssize_t n = read( connection.fd, input.data() + used, readChunk );
+			input.resize( used + ( n > 0 ? (size_t)n : 0 ) );
+
+			if( n == 0 ){
+				open = false;
+				break;
+			}
+			if( n < 0 ){
+				if( errno == EINTR )
+					continue;
+				if( errno != EAGAIN && errno != EWOULDBLOCK )
+					open = false;
+				break;
+			}
+		}
+
+		size_t offset = 0;
+		while( input.size() - offset >= sizeof(header_t) ){
+			header_t header;
+			memcpy( &header, input.data() + offset, sizeof(header) );
+
+			if( header.length > maxMessage )
+				return false;
+			if( input.size() - offset < sizeof(header) + header.length )
+				break;
+
+			if( !handleMessage( connection, header,
+				input.data() + offset + sizeof(header) ) )
+				return false;
+
+			offset += sizeof(header) + header.length;
+			if( connection.dropped )
+				break;
+		}
+		input.erase( input.begin(), input.begin() + offset );
+
+		return open;
+	}
+
+	bool handleMessage(connection_t &connection, const header_t &header, const char *body){
+		// hello를 받기 전에는 다른 메시지를 받지 않는다.
+		if( ( connection.remoteId == 0 ) != ( header.type == messageHello ) )
+			return false;
+
+		switch( header.type ){
+		case messageHello:
+			return hello( connection, header, body );
+
+		case messageAck:
+			return acknowledge( connection, header.count );
+
+		case messageDepth:
+			connection.remoteDepth = header.count;
+			maybeSteal( connection );
+			return true;
+
+		case messageSteal:
+			giveWork( connection, header.count );
+			return true;
+
+		case messageItems:
+			return takeWork( connection, header, body );
+		}
+		return false;
+	}
+
+	/*
+		hello
+
+		상대의 node id를 받는다.
+		같은 노드와 이미 다른 연결이 있으면 양쪽이 같은 연결을 고르도록
+		id가 작은 노드가 연 연결을 남기고 나머지는 dropped로 표시한다.
+		같은 쪽이 연 연결들이면 연 쪽만 나중에 hello를 받은 연결을 끊는다.
+		자기 자신과의 연결도 끊는다.
+	*/
+	bool hello(connection_t &connection, const header_t &header, const char *body){
+		uint64_t remoteId;
+
+		if( header.length != sizeof(remoteId) )
+			return false;
+		memcpy( &remoteId, body, sizeof(remoteId) );
+		if( remoteId == 0 )
+			return false;
+		connection.remoteId = remoteId;
+
+		connection_t *drop = nullptr;
+		if( remoteId == nodeId )
+			drop = &connection;
+		else for( auto &other : connections ){
+			if( &other == &connection || other.dropped || other.remoteId != remoteId )
+				continue;
+
+			if( initiator( connection ) != initiator( other ) )
+				drop = initiator( connection ) == std::min( nodeId, remoteId ) ?
+					&other : &connection;
+			else if( initiator( connection ) == nodeId )
+				drop = &connection;
+			break;
+		}
+
+		std::unique_lock<std::mutex> guard( peerMutex );
+		if( connection.peer >= 0 )
+			peers[ connection.peer ].remoteId = remoteId;
+		if( drop != nullptr ){
+			drop->dropped = true;
+			if( drop->peer >= 0 )
+				peers[ drop->peer ].redundant = true;
+		}
+		return true;
+	}
+
+	uint64_t initiator(const connection_t &connection) const{
+		return connection.peer >= 0 ? nodeId : connection.remoteId;
+	}
+
+	/*
+		acknowledge
+
+		상대가 가장 먼저 보낸 items를 받아 넣었으므로 저널에서 완료로 기록한다.
+	*/
+	bool acknowledge(connection_t &connection, size_t count){
+		if( connection.given.empty() || connection.given.front().items.size() != count )
+			return false;
+
+		pool.completeStolen( connection.given.front().journalIds );
+		nGiven.fetch_add( count );
+		connection.given.pop_front();
+		return true;
+	}
+
+	/*
+		maybeSteal
+
+		놀고 있는 worker가 있고 상대가 충분히 밀려 있으면 workItem을 요청한다.
+	*/
+	void maybeSteal(connection_t &connection){
+		if( connection.stealPending )
+			return;
+
+		size_t local = pool.queryQueueDepth();
+		int waiting = 0;
+		pool.queryPoolStatus( &waiting, nullptr );
+
+		if( waiting == 0 && local > 0 )
+			return;
+		if( connection.remoteDepth < local + stealThreshold.load() )
+			return;
+
+		size_t want = std::min( ( connection.remoteDepth - local ) / 2, stealBatch.load() );
+		if( want == 0 )
+			return;
+
+		send( connection, messageSteal, (uint32_t)want, nullptr, 0 );
+		connection.stealPending = true;
+	}
+
+	/*
+		giveWork
+
+		요청받은 만큼 로컬 큐에서 꺼내 직렬화하여 보낸다. ( 없으면 0개를 보낸다. )
+		보낸 workItem은 ack를 받을 때까지 given에 남겨둔다.
+	*/
+	void giveWork(connection_t &connection, size_t want){
+		given_t batch;
+		std::vector<T> &items = batch.items;
+		std::vector<char> body;
+
+		pool.stealWork( items, std::min( want, stealBatch.load() ), &batch.journalIds );
+
+		for( auto &item : items ){
+			uint32_t len = (uint32_t)PoolCodec<T>::encodedSize( item );
+			size_t offset = body.size();
+
+			body.resize( offset + sizeof(len) + len );
+			memcpy( body.data() + offset, &len, sizeof(len) );
+			PoolCodec<T>::encode( item, body.data() + offset + sizeof(len) );
+		}
+
+		send( connection, messageItems, (uint32_t)items.size(), body.data(), body.size() );
+		if( !items.empty() )
+			connection.given.push_back( std::move(batch) );
+	}
+
+	/*
+		takeWork
+
+		받은 workItem들을 로컬 풀에 넣는다.
+		길이가 올바른 인코딩이 아닌 workItem이 있으면 하나도 넣지 않고 false를 반환한다.
+	*/
+	bool takeWork(connection_t &connection, const header_t &header, const char *body){
+		std::vector<T> items;
+		size_t offset = 0;
+
+		// count는 상대가 보낸 값이므로 본문에 담길 수 있는 수로 자른다.
+		items.reserve( std::min( (size_t)header.count, (size_t)header.length / sizeof(uint32_t) ) );
+		for( uint32_t i=0;i<header.count;i++ ){
+			uint32_t len;
+
+			if( header.length - offset < sizeof(len) )
+				return false;
+			memcpy( &len, body + offset, sizeof(len) );
+			offset += sizeof(len);
+
+			T item;
+			if( header.length - offset < len ||
+				!PoolCodecCheck<T>::tryDecode( body + offset, len, &item ) )
+				return false;
+			items.push_back( std::move(item) );
+			offset += len;
+		}
+
+		connection.stealPending = false;
+		nStolen.fetch_add( items.size() );
+		pool.enqueueBulk( std::move(items) );
+
+		// 넣은 뒤에 ack를 보내야 넘겨준 노드가 저널에서 지워도 잃지 않는다.
+		if( header.count > 0 )
+			send( connection, messageAck, header.count, nullptr, 0 );
+		return true;
+	}
+
+protected:
+	pool_t &pool;
+
+	int listenSocket;
+	uint16_t listenPort;
+	int wakeEvent;		// addPeer, kill 에서 I/O 쓰레드를 깨우는 eventfd
+
+	uint64_t nodeId;	// hello로 알리는 이 노드의 임의의 id
+
+	std::vector<peer_t> peers;
+	std::mutex peerMutex;
+	std::list<connection_t> connections;	// I/O 쓰레드 전용
+
+	std::atomic<int> gossipInterval;	// ms
+	std::atomic<size_t> stealThreshold;
+	std::atomic<size_t> stealBatch;
+
+	std::atomic<size_t> nStolen;
+	std::atomic<size_t> nGiven;
+
+	std::thread io;
+	std::atomic<bool> quit;
+};
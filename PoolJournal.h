@@ -0,0 +1,490 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <system_error>
+#include <stdexcept>
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PoolCodec.h"
+
+/*
+	PoolJournal
+
+	work queue를 위한 write-ahead 로그.
+
+	enqueue된 workItem은 ENQ 레코드로, 처리가 끝난 workItem은 DONE 레코드로
+	로그 파일 끝에 덧붙는다. 레코드는 메모리 버퍼에 모였다가 flush 쓰레드가
+	commitInterval마다 한 번에 write + fdatasync 한다. ( group commit )
+
+	다시 열 때 DONE이 없는 ENQ 레코드들을 replay로 돌려받는다.
+	로그가 compactBytes를 넘으면 아직 끝나지 않은 ENQ만 남겨 새로 쓴다.
+
+	write나 fdatasync가 실패하면 그 오류를 기억해두고 더 기록하지 않는다.
+	이후의 append와 waitDurable은 그 오류로 std::system_error를 던진다.
+*/
+class PoolJournal{
+public:
+	/*
+		PoolJournal
+
+		로그 파일을 열고 남아있는 레코드를 검사한다.
+		중간에 잘린 꼬리 레코드는 잘라낸다.
+
+		_path : 로그 파일 경로
+		_commitInterval : group commit 주기
+		_compactBytes : 로그를 압축할 크기
+	*/
+	PoolJournal(const std::string &_path,
+		    std::chrono::microseconds _commitInterval = std::chrono::microseconds( 2000 ),
+		    size_t _compactBytes = 64 * 1024 * 1024) :
+		path( _path ),
+		commitInterval( _commitInterval ), compactBytes( _compactBytes ),
+		compactAt( _compactBytes ),
+		fd( -1 ), fileBytes( 0 ),
+		nextId( 1 ), appendedId( 0 ), durableId( 0 ),
+		syncError( 0 ), syncRequested( false ), stop( false ) {
+
+		recover();
+
+		flusher = std::thread( &PoolJournal::flushthread, this );
+	}
+	~PoolJournal(){
+		{
+			std::unique_lock<std::mutex> guard( journalMutex );
+			stop = true;
+		}
+		commitSignal.notify_all();
+		flusher.join();
+
+		close( fd );
+	}
+
+	PoolJournal(const PoolJournal &) = delete;
+	PoolJournal &operator=(const PoolJournal &) = delete;
+
+	/*
+		replay
+
+		지난 실행에서 끝나지 못한 workItem들을 기록된 순서대로 돌려준다.
+		돌려준 workItem들은 원래의 id를 유지하므로, 처리가 끝나면 complete를 호출한다.
+
+		callback : void(uint64_t id, T &&item)
+	*/
+	template <typename T, typename F>
+	void replay(F callback){
+		std::vector<pending_t> items;
+		{
+			std::unique_lock<std::mutex> guard( journalMutex );
+			items.swap( recovered );
+		}
+
+		for( auto &p : items ){
+			T item = PoolCodec<T>::decode( p.payload.data(), p.payload.size() );
+			callback( p.id, std::move(item) );
+		}
+	}
+
+	/*
+		append
+
+		workItem의 ENQ 레코드를 로그에 추가하고 id를 반환한다.
+		반환 시점에는 아직 디스크에 기록되지 않았을 수 있다. ( waitDurable 참고 )
+		직렬화된 크기가 4 GiB 이상이면 std::length_error를 던진다.
+	*/
+	template <typename T>
+	uint64_t append(const T &item){
+		size_t len = PoolCodec<T>::encodedSize( item );
+
+		// 레코드 헤더의 길이는 32비트이다.
+		if( len > UINT32_MAX )
+			throw std::length_error( "PoolJournal : workItem is larger than 4 GiB" );
+
+		std::unique_lock<std::mutex> guard( journalMutex );
+		throwIfFailed();
+
+		uint64_t id = nextId++;
+		size_t offset = pushHeader( recordEnq, id, len );
+
+		PoolCodec<T>::encode( item, pending.data() + offset + sizeof(header_t) );
+		sealRecord( offset );
+
+		live.insert( id );
+		appendedId = id;
+
+		return id;
+	}
+
+	/*
+		complete
+
+		id의 workItem이 처리되었음을 기록한다.
+	*/
+	void complete(uint64_t id){
+		std::unique_lock<std::mutex> guard( journalMutex );
+
+		// 기록에 실패했으면 flush 쓰레드가 멈췄으므로 레코드를 쌓지 않는다.
+		if( syncError == 0 ){
+			size_t offset = pushHeader( recordDone, id, 0 );
+			sealRecord( offset );
+		}
+
+		live.erase( id );
+	}
+
+	/*
+		waitDurable
+
+		id까지의 ENQ 레코드가 디스크에 기록될 때까지 기다린다.
+		기록에 실패했으면 std::system_error를 던진다.
+	*/
+	void waitDurable(uint64_t id){
+		std::unique_lock<std::mutex> guard( journalMutex );
+
+		while( durableId < id && !stop && syncError == 0 ){
+			syncRequested = true;
+			commitSignal.notify_one();
+			durableSignal.wait( guard );
+		}
+
+		if( durableId < id )
+			throwIfFailed();
+	}
+
+	/*
+		liveCount
+
+		끝나지 않은 workItem의 수
+	*/
+	size_t liveCount(){
+		std::unique_lock<std::mutex> guard( journalMutex );
+		return live.size();
+	}
+
+protected:
+	enum : uint32_t{
+		recordEnq = 1,
+		recordDone = 2
+	};
+
+	struct header_t{
+		uint32_t type;
+		uint32_t len;		// payload 길이
+		uint64_t id;
+		uint32_t checksum;	// 헤더( checksum 제외 ) + payload 의 FNV-1a
+		uint32_t reserved;
+	};
+
+	struct pending_t{
+		uint64_t id;
+		std::string payload;
+	};
+
+	static uint32_t fnv1a(const void *data, size_t len, uint32_t hash = 2166136261u){
+		const unsigned char *p = (const unsigned char*)data;
+
+		for( size_t i=0;i<len;i++ ){
+			hash ^= p[i];
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+	static uint32_t checksumOf(const header_t &header, const void *payload){
+		uint32_t hash = fnv1a( &header, offsetof(header_t, checksum) );
+		return fnv1a( payload, header.len, hash );
+	}
+
+	size_t pushHeader(uint32_t type, uint64_t id, size_t len){
+		size_t offset = pending.size();
+		header_t header;
+
+		header.type = type;
+		header.len = (uint32_t)len;
+		header.id = id;
+		header.checksum = 0;
+		header.reserved = 0;
+
+		pending.resize( offset + sizeof(header_t) + len );
+		memcpy( &pending[offset], &header, sizeof(header_t) );
+
+		return offset;
+	}
+	void sealRecord(size_t offset){
+		header_t header;
+
+		memcpy( &header, &pending[offset], sizeof(header_t) );
+		header.checksum = checksumOf( header, pending.data() + offset + sizeof(header_t) );
+		memcpy( &pending[offset], &header, sizeof(header_t) );
+
+		if( pending.size() >= batchBytes )
+			commitSignal.notify_one();
+	}
+
+	/*
+		scan
+
+		data에 담긴 레코드들을 훑으며 callback( header, payload, offset )을 부른다.
+		온전한 레코드가 끝나는 위치를 반환한다.
+	*/
+	template <typename F>
+	static size_t scan(const char *data, size_t size, F callback){
+		size_t pos = 0;
+
+		while( pos + sizeof(header_t) <= size ){
+			header_t header;
+			memcpy( &header, data + pos, sizeof(header_t) );
+
+			if( ( header.type != recordEnq && header.type != recordDone ) ||
+				pos + sizeof(header_t) + header.len > size )
+				break;
+
+			const char *payload = data + pos + sizeof(header_t);
+			if( checksumOf( header, payload ) != header.checksum )
+				break;
+
+			callback( header, payload, pos );
+			pos += sizeof(header_t) + header.len;
+		}
+		return pos;
+	}
+
+	/*
+		recover
+
+		로그 파일을 열고 끝나지 않은 ENQ 레코드들을 모은다.
+	*/
+	void recover(){
+		fd = open( path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600 );
+		if( fd < 0 )
+			throw std::system_error( errno, std::generic_category(), "PoolJournal : open" );
+
+		struct stat st;
+		fstat( fd, &st );
+
+		size_t size = (size_t)st.st_size;
+		size_t valid = 0;
+
+		if( size > 0 ){
+			void *base = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+			if( base == MAP_FAILED )
+				throw std::system_error( errno, std::generic_category(), "PoolJournal : mmap" );
+
+			std::vector<pending_t> enqueued;
+			std::unordered_set<uint64_t> done;
+
+			valid = scan( (const char*)base, size,
+				[&](const header_t &header, const char *payload, size_t){
+					if( header.type == recordEnq ){
+						pending_t p;
+						p.id = header.id;
+						p.payload.assign( payload, header.len );
+						enqueued.push_back( std::move(p) );
+					}
+					else
+						done.insert( header.id );
+
+					if( header.id >= nextId )
+						nextId = header.id + 1;
+				});
+
+			munmap( base, size );
+
+			for( auto &p : enqueued ){
+				if( done.count( p.id ) == 0 ){
+					live.insert( p.id );
+					recovered.push_back( std::move(p) );
+				}
+			}
+		}
+
+		// 잘린 꼬리 레코드 제거
+		if( valid < size ){
+			if( ftruncate( fd, (off_t)valid ) != 0 || fdatasync( fd ) != 0 )
+				throw std::system_error( errno, std::generic_category(), "PoolJournal : ftruncate" );
+		}
+
+		fileBytes = valid;
+		appendedId = durableId = nextId - 1;
+	}
+
+	/*
+		writeAll
+
+		data를 모두 쓰고 fdatasync 한다.
+		flush 쓰레드에서 부르므로 던지지 않고, 실패하면 errno를 반환한다. ( 성공하면 0 )
+	*/
+	static int writeAll(int fd, const char *data, size_t size){
+		while( size > 0 ){
+			ssize_t n = write( fd, data, size );
+			if( n < 0 ){
+				if( errno == EINTR )
+					continue;
+				return errno;
+			}
+			data += n;
+			size -= (size_t)n;
+		}
+
+		if( fdatasync( fd ) != 0 )
+			return errno;
+		return 0;
+	}
+
+	/*
+		throwIfFailed
+
+		기록에 실패한 적이 있으면 그 오류를 던진다. ( journalMutex를 잡고 불러야 한다. )
+	*/
+	void throwIfFailed(){
+		if( syncError != 0 )
+			throw std::system_error( syncError, std::generic_category(), "PoolJournal : write" );
+	}
+
+	/*
+		flushthread
+
+		group commit 쓰레드
+	*/
+	void flushthread(){
+		std::vector<char> batch;
+		std::unique_lock<std::mutex> guard( journalMutex );
+
+		while( true ){
+			commitSignal.wait_for( guard, commitInterval, [&](){
+				return stop || syncRequested || pending.size() >= batchBytes;
+			});
+
+			if( pending.empty() ){
+				if( stop )
+					break;
+				continue;
+			}
+
+			batch.swap( pending );
+			pending.clear();
+
+			uint64_t upto = appendedId;
+			syncRequested = false;
+
+			guard.unlock();
+				int err = writeAll( fd, batch.data(), batch.size() );
+			guard.lock();
+
+			// 실패한 batch는 디스크에 어디까지 남았는지 알 수 없으므로 durableId를 올리지 않고 멈춘다.
+			if( err != 0 ){
+				syncError = err;
+				pending.clear();
+				break;
+			}
+
+			fileBytes += batch.size();
+			durableId = upto;
+			durableSignal.notify_all();
+
+			if( fileBytes >= compactAt )
+				compact( guard );
+		}
+
+		durableSignal.notify_all();
+	}
+
+	/*
+		compact
+
+		끝나지 않은 ENQ 레코드만 새 파일에 옮겨 쓰고 로그를 교체한다.
+		flush 쓰레드에서만 호출되므로 파일에 쓰는 쪽은 항상 하나이다.
+	*/
+	void compact(std::unique_lock<std::mutex> &guard){
+		std::unordered_set<uint64_t> snapshot( live );
+		size_t size = fileBytes;
+
+		guard.unlock();
+
+		std::string tmpPath = path + ".compact";
+		int tmp = open( tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600 );
+		size_t written = 0;
+
+		if( tmp >= 0 ){
+			void *base = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+			if( base != MAP_FAILED ){
+				std::vector<char> out;
+
+				scan( (const char*)base, size,
+					[&](const header_t &header, const char *, size_t offset){
+						if( header.type == recordEnq && snapshot.count( header.id ) ){
+							const char *rec = (const char*)base + offset;
+							out.insert( out.end(), rec, rec + sizeof(header_t) + header.len );
+						}
+					});
+				munmap( base, size );
+
+				// 새 파일을 쓰지 못하면 지금의 로그를 그대로 쓴다.
+				written = out.size();
+				if( writeAll( tmp, out.data(), out.size() ) == 0 &&
+					rename( tmpPath.c_str(), path.c_str() ) == 0 ){
+					close( fd );
+					fd = tmp;
+					tmp = -1;
+				}
+			}
+			if( tmp >= 0 ){
+				close( tmp );
+				unlink( tmpPath.c_str() );
+				written = size;
+			}
+		}
+		else
+			written = size;
+
+		guard.lock();
+
+		fileBytes = written;
+		compactAt = written * 2 > compactBytes ? written * 2 : compactBytes;
+	}
+
+protected:
+	static const size_t batchBytes = 1024 * 1024;	// 이만큼 쌓이면 주기를 기다리지 않고 commit
+
+	std::string path;
+	std::chrono::microseconds commitInterval;
+	size_t compactBytes;
+	size_t compactAt;	// 다음 압축을 시작할 크기
+
+	int fd;
+	size_t fileBytes;	// 디스크에 기록된 로그의 크기
+
+	std::vector<char> pending;	// 아직 기록되지 않은 레코드들
+	std::unordered_set<uint64_t> live;	// 끝나지 않은 workItem의 id
+	std::vector<pending_t> recovered;	// replay를 기다리는 workItem들
+
+	uint64_t nextId;
+	uint64_t appendedId;	// 마지막으로 append된 id
+	uint64_t durableId;	// 디스크에 기록된 마지막 id
+	int syncError;		// write / fdatasync가 실패한 errno ( 없으면 0 )
+
+	bool syncRequested;
+	bool stop;
+
+	std::mutex journalMutex;
+	std::condition_variable commitSignal;
+	std::condition_variable durableSignal;
+
+	std::thread flusher;
+};
@@ -0,0 +1,1154 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <type_traits>
+#include <stdexcept>
+#include <system_error>
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "PoolCodec.h"
+#include "ShmRing.h"
+#include "RecyclePolicy.h"
+
+/*
+	ProcessPool
+
+	worker를 쓰레드가 아닌 프로세스로 돌리는 풀.
+	핸들러가 죽거나 메모리를 망가뜨려도 부모 프로세스와 다른 worker는 영향을 받지 않는다.
+
+	workItem은 fork 전에 만든 공유 메모리 위의 ShmRing으로 넘기고,
+	결과는 worker마다 있는 공유 메모리 mailbox로 돌려받는다.
+	잠들고 깨우는 것은 공유 메모리 위의 futex로 한다.
+	workItem은 PoolCodec<T>로 링 슬롯 위에 바로 직렬화된다.
+	( trivially copyable 타입은 memcpy 한 번 )
+	worker는 꺼낸 workItem을 자기 inflight 슬롯( 공유 메모리 )으로 옮기고 링 슬롯을
+	바로 돌려주므로, 핸들러가 오래 걸려도 링이 막히지 않는다.
+	핸들러가 PoolCodec<T>::view_t를 받으면 decode 없이 inflight 슬롯의 바이트열을 그 자리에서 읽는다.
+
+	externalThreshold보다 큰 workItem은 링에 복사하지 않고 memfd에 직렬화하여
+	링에는 일련번호만 넣는다. 그것을 꺼낸 worker가 mailbox로 요청하면
+	부모가 그 fd를 worker 전용 소켓으로 SCM_RIGHTS로 넘긴다.
+	worker는 memfd를 매핑하여 그 자리에서 읽는다.
+
+	worker는 부모가 아니라 template 프로세스에서 fork된다.
+	template은 생성자에서 한 번 fork되어 warmup으로 읽기 전용 상태( 모델 등 )를
+	한 번만 올려두고, 그 상태를 copy-on-write로 공유하는 worker들을 fork한다.
+	lifeTime을 다한 worker의 자리도 template이 다시 fork하여 채우므로
+	새 worker는 준비 과정 없이 바로 일을 받는다.
+	부모 프로세스는 쓰레드가 여럿이 된 뒤에 fork하지 않는다.
+
+	template은 생성자에서 부모를 fork하여 만들고 그 안에서 warmup과 worker들의 코드
+	( malloc 등 )를 실행하므로, 생성자를 부르는 시점에 부모에 다른 쓰레드가 있으면 안 된다.
+	fork된 자식에는 부른 쓰레드만 남으므로 다른 쓰레드가 잡고 있던 malloc / stdio 등의
+	락이 잠긴 채로 남아 template이나 worker가 멈출 수 있다.
+	ProcessPool은 main의 시작처럼 다른 쓰레드( 다른 풀, 로깅 쓰레드 등 )를 띄우기 전에 만든다.
+
+	핸들러 도중 죽은 worker는 template이 pidfd로 바로 알아채고 새 worker로 채운다.
+	죽은 worker가 처리하던 workItem은 다시 work 링에 넣고,
+	poisonLimit번 worker를 죽인 workItem은 실패로 완료시킨다.
+	링 슬롯은 잡은 worker의 번호와 함께 한 번에 잡히고, 결과는 mailbox의 tail을 쓰는
+	한 번으로 넘어가므로 worker가 어느 시점에 죽어도 template이 잡힌 슬롯을 돌려주고
+	workItem을 다시 넣거나 남은 결과를 대신 넘긴다. 완료 콜백은 workItem마다 한 번 불린다.
+	( 핸들러가 끝난 직후 결과를 남기기 전에 죽으면 핸들러는 한 번 더 불릴 수 있다. )
+
+	T : workItem의 타입 ( PoolCodec<T>가 있어야 한다 )
+	H : 핸들러의 타입 ( bool(T) 또는 bool(PoolCodec<T>::view_t) )
+*/
+template <typename T, typename H = std::function<bool(T)> >
+class ProcessPool{
+public:
+	typedef H					handler_t;
+	typedef std::function<void(uint64_t, bool)>	completion_t;
+	typedef std::function<void()>			warmup_t;
+
+	/*
+		ProcessPool
+
+		_workers : 미리 fork해 둘 worker 프로세스의 수
+		_lifeTime : 한 개의 worker가 일을 몇 번 수행할지 횟수
+		_handler : worker 프로세스에서 workItem을 핸들링할 핸들러
+		_slotSize : 링 슬롯 하나의 크기 ( 직렬화된 workItem의 최대 크기 )
+		_capacity : 링에 담을 수 있는 workItem의 수
+	*/
+	ProcessPool( int _workers, int _lifeTime, handler_t _handler,
+		     uint32_t _slotSize = 4096, uint32_t _capacity = 1024 ) :
+		ProcessPool( _workers, _lifeTime, _handler, warmup_t(),
+			     _slotSize, _capacity ) {
+	}
+	/*
+		ProcessPool
+
+		_workers : 미리 fork해 둘 worker 프로세스의 수
+		_lifeTime : 한 개의 worker가 일을 몇 번 수행할지 횟수
+		_handler : worker 프로세스에서 workItem을 핸들링할 핸들러
+		_warmup : template 프로세스에서 worker를 fork하기 전에 한 번 호출된다.
+		          여기서 올린 상태는 모든 worker가 copy-on-write로 공유한다.
+		_slotSize : 링 슬롯 하나의 크기 ( 직렬화된 workItem의 최대 크기 )
+		_capacity : 링에 담을 수 있는 workItem의 수
+
+		template을 fork하므로 다른 쓰레드를 띄우기 전에 불러야 한다. ( 클래스 설명 참고 )
+	*/
+	ProcessPool( int _workers, int _lifeTime, handler_t _handler,
+		     warmup_t _warmup,
+		     uint32_t _slotSize = 4096, uint32_t _capacity = 1024 ) :
+		handler( _handler ), warmup( _warmup ),
+		nWorkers( _workers ), lifeTime( _lifeTime ),
+		nExternal( 0 ), nextSeq( 1 ), killed( false ) {
+
+		static_assert( PoolCodec<T>::supported,
+			"ProcessPool : workItem requires a PoolCodec<T> specialization" );
+
+		mapShared( _slotSize, _capacity );
+
+		spawnTemplate();
+
+		// worker 쪽 소켓은 template과 worker만 쓴다.
+		for( int &fd : workerSockets ){
+			close( fd );
+			fd = -1;
+		}
+
+		collector = std::thread( &ProcessPool::collectthread, this );
+	}
+	virtual ~ProcessPool(){
+		kill();
+
+		munmap( region, regionSize );
+		close( quitEvent );
+		for( int fd : itemSockets )
+			close( fd );
+
+		for( auto &external : externals )
+			close( external.second );
+	}
+
+	ProcessPool(const ProcessPool &) = delete;
+	ProcessPool &operator=(const ProcessPool &) = delete;
+
+	/*
+		enqueue
+
+		workItem을 work 링에 직렬화하여 넣는다.
+		링이 가득 차 있으면 자리가 날 때까지 블록된다.
+		externalThreshold보다 크면 memfd로 넘긴다.
+
+		workItem : 넣을 workItem
+		반환값 : 완료 콜백에서 workItem을 구분할 일련번호 ( 종료 중이면 0 )
+	*/
+	uint64_t enqueue(const T &workItem){
+		size_t len = PoolCodec<T>::encodedSize( workItem );
+		uint64_t seq = nextSeq.fetch_add( 1 );
+
+		if( len > externalThreshold.load() )
+			return enqueueExternal( workItem, len, seq ) ? seq : 0;
+
+		bool pushed = workRing->push( (uint32_t)len, seq,
+			[&](void *dst){
+				PoolCodec<T>::encode( workItem, dst );
+			}, &control->quit );
+
+		return pushed ? seq : 0;
+	}
+
+	/*
+		setCompletionHandler
+
+		worker가 workItem을 처리할 때마다 부모 프로세스에서 호출될 콜백을 지정한다.
+		콜백은 결과 수집 쓰레드에서 ( 일련번호, 핸들러의 반환값 ) 으로 호출된다.
+	*/
+	void setCompletionHandler(completion_t _onComplete){
+		std::unique_lock<std::mutex> guard( poolMutex );
+		onComplete = _onComplete;
+	}
+
+	/*
+		setExternalThreshold
+
+		이 크기( 바이트 )보다 큰 workItem은 링에 복사하지 않고 memfd로 넘긴다.
+		링 슬롯보다 큰 workItem은 항상 memfd로 넘긴다.
+	*/
+	void setExternalThreshold(size_t bytes){
+		externalThreshold.store( std::min( bytes, (size_t)workRing->slotSize() ) );
+	}
+
+	/*
+		setRecyclePolicy
+
+		처리 횟수( lifeTime )와 별개로 worker 프로세스를 교체할 조건을 지정한다.
+		메모리는 worker가 혼자 쓰는 상주 메모리( privateMemoryBytes )로 재므로
+		template에서 물려받은 copy-on-write 페이지는 읽기만 해서는 늘어나지 않는다.
+		조건을 넘은 worker는 workItem 사이에서 종료하고 template이 새로 fork한다.
+		이미 실행 중인 worker에도 다음 workItem부터 적용된다.
+	*/
+	void setRecyclePolicy(const RecyclePolicy &policy){
+		control->recycleMemory.store( policy.maxMemoryGrowth );
+		control->recycleCpuMs.store( policy.maxCpuTimeMs );
+		control->recycleAgeMs.store( policy.maxAgeMs );
+		control->recycleInterval.store( policy.checkInterval );
+		control->recycleVersion.fetch_add( 1 );
+	}
+
+	/*
+		setPoisonLimit
+
+		workItem 하나가 worker를 몇 번 죽이면 다시 넣지 않고 실패로 완료시킬지 정한다.
+		실패로 완료된 workItem은 완료 콜백에 false로 전달된다.
+	*/
+	void setPoisonLimit(int limit){
+		control->poisonLimit.store( limit > 0 ? limit : 1 );
+	}
+
+	/*
+		queryCrashStatus
+
+		crashed : 핸들러 도중 죽은 worker의 수를 받아올 포인터
+		poisoned : poisonLimit을 넘어 실패로 완료된 workItem의 수를 받아올 포인터
+	*/
+	void queryCrashStatus(int *crashed,int *poisoned){
+		if( crashed != nullptr )
+			*crashed = control->nCrashed.load();
+		if( poisoned != nullptr )
+			*poisoned = control->nPoisoned.load();
+	}
+
+	/*
+		queryPoolStatus
+
+		풀의 상태를 얻어온다.
+
+		waiting : waiting중인 worker의 수를 받아올 포인터
+		working : working중인 worker의 수를 받아올 포인터
+	*/
+	void queryPoolStatus(int *waiting,int *working){
+		if( waiting != nullptr )
+			*waiting = control->nWaiting.load();
+		if( working != nullptr )
+			*working = control->nWorking.load();
+	}
+
+	/*
+		kill
+
+		모든 worker 프로세스를 종료시킨다.
+		처리 중인 workItem은 끝날 때까지 기다리고, 오래 걸리면 SIGKILL로 끝낸다.
+	*/
+	void kill(){
+		if( killed.exchange( true ) )
+			return;
+
+		postQuit();
+
+		collector.join();
+
+		// template이 worker들을 정리하고 종료하기를 기다린다.
+		waitOrKill( templatePid, std::chrono::steady_clock::now() + std::chrono::seconds( 2 ) );
+	}
+
+protected:
+	struct control_t{
+		std::atomic<uint32_t> quit;	// 종료 요청 플래그
+		std::atomic<int> nWaiting;	// 링에서 workItem을 기다리는 worker의 수
+		std::atomic<int> nWorking;	// 핸들러를 실행 중인 worker의 수
+		std::atomic<int> nAlive;	// 살아있는 worker 프로세스의 수
+
+		std::atomic<uint32_t> resultSignal;	// worker가 mailbox에 결과를 넣을 때마다 증가
+		std::atomic<uint32_t> nResultWaiters;
+		std::atomic<uint32_t> spaceSignal;	// 결과 수집 쓰레드가 mailbox를 비울 때마다 증가
+		std::atomic<uint32_t> nSpaceWaiters;
+
+		// worker 교체 조건 ( RecyclePolicy )
+		std::atomic<uint64_t> recycleMemory;
+		std::atomic<uint64_t> recycleCpuMs;
+		std::atomic<uint64_t> recycleAgeMs;
+		std::atomic<int> recycleInterval;
+		std::atomic<uint32_t> recycleVersion;	// 교체 조건이 바뀔 때마다 증가
+
+		std::atomic<int> poisonLimit;	// workItem이 worker를 죽일 수 있는 횟수
+		std::atomic<int> nCrashed;	// 핸들러 도중 죽은 worker의 수
+		std::atomic<int> nPoisoned;	// 실패로 완료된 workItem의 수
+	};
+
+	/*
+		inflight_t
+
+		worker마다 하나씩 있는, 가지고 있는 workItem의 정보와 사본, 결과 mailbox.
+		worker가 죽으면 template이 이 정보로 workItem을 다시 넣거나 결과를 대신 넘긴다.
+
+		mailbox는 worker( 죽은 뒤에는 template ) 하나가 쓰고 결과 수집 쓰레드가 읽는
+		SPSC 큐이다. resultTail을 쓰는 것이 결과를 넘기는 시점이다.
+	*/
+	struct inflight_t{
+		std::atomic<uint32_t> busy;	// 가지고 있는 workItem의 상태 ( busyState )
+		std::atomic<uint32_t> running;	// 핸들러를 실행 중이면 1
+		uint64_t tag;
+		uint32_t len;			// busyInline일 때 사본의 길이
+		uint32_t status;		// busyResult일 때 핸들러의 결과 ( resultStatus )
+		std::atomic<uint32_t> resultHead;	// 결과 수집 쓰레드가 읽은 위치
+		std::atomic<uint32_t> resultTail;	// worker가 쓴 위치
+		// 뒤에 slotSize 바이트의 사본과 mailboxDepth개의 result_t가 온다.
+	};
+	struct result_t{
+		uint64_t tag;
+		uint32_t status;		// resultStatus
+		uint32_t reserved;
+	};
+
+	enum busyState{
+		busyNone = 0,
+		busyInline = 1,		// inflight 슬롯에 사본을 옮긴 workItem
+		busyExternal = 2,	// memfd로 받는 workItem ( 사본은 부모가 가지고 있다 )
+		busyResult = 3,		// 핸들러가 끝나 status를 mailbox에 넘기는 중
+	};
+
+	/*
+		external_t
+
+		memfd로 넘기는 workItem의 정보. fd와 함께 worker의 item 소켓으로 보낸다.
+	*/
+	struct external_t{
+		uint64_t tag;
+		uint64_t len;
+	};
+
+	// 링 tag의 상위 8비트에는 workItem이 worker를 죽인 횟수를 담는다.
+	// externalBit이 있는 tag는 memfd로 넘기는 workItem이다. ( 링 슬롯은 비어 있다 )
+	static const int crashShift = 56;
+	static const uint64_t externalBit = (uint64_t)1 << ( crashShift - 1 );
+	static const uint64_t seqMask = externalBit - 1;
+
+	enum resultStatus{
+		resultFailed = 0,
+		resultSucceeded = 1,
+		resultPoisoned = 2,
+		resultFetch = 3,	// memfd workItem의 fd를 보내달라는 요청
+	};
+
+	static const uint32_t mailboxDepth = 64;	// worker별 결과 mailbox의 크기 ( 2의 거듭제곱 )
+
+	// 핸들러가 view_t를 받으면 decode 없이 그 자리에서 읽는다.
+	template <typename V>
+	static constexpr bool acceptsView(){
+		if constexpr( std::is_void<V>::value )
+			return false;
+		else
+			return std::is_invocable_r<bool, H&, V>::value;
+	}
+	static constexpr bool viewHandler = acceptsView<typename PoolCodecView<T>::type>();
+
+	static size_t alignUp(size_t n){
+		return ( n + 63 ) & ~(size_t)63;
+	}
+
+	/*
+		mapShared
+
+		control / work 링 / worker별 inflight 슬롯을 담을 공유 메모리를 만든다.
+		fork된 worker들은 같은 매핑을 물려받는다.
+	*/
+	void mapShared(uint32_t slotSize, uint32_t capacity){
+		// 링 슬롯을 잡는 worker의 번호가 capacity - 2보다 작아야 한다. ( ShmRing 참고 )
+		uint32_t workCapacity = std::max( capacity, (uint32_t)nWorkers + 2 );
+
+		size_t controlBytes = alignUp( sizeof(control_t) );
+		size_t workBytes = alignUp( ShmRing::bytesFor( workCapacity, slotSize ) );
+
+		dataOffset = alignUp( sizeof(inflight_t) );
+		mailboxOffset = dataOffset + alignUp( slotSize );
+		inflightStride = mailboxOffset + alignUp( sizeof(result_t) * mailboxDepth );
+
+		regionSize = controlBytes + workBytes + inflightStride * nWorkers;
+		region = mmap( nullptr, regionSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+		if( region == MAP_FAILED )
+			throw std::system_error( errno, std::generic_category(), "ProcessPool : mmap" );
+
+		char *base = (char*)region;
+
+		control = new ( base ) control_t();
+		control->quit.store( 0 );
+		control->nWaiting.store( 0 );
+		control->nWorking.store( 0 );
+		control->nAlive.store( 0 );
+		control->resultSignal.store( 0 );
+		control->nResultWaiters.store( 0 );
+		control->spaceSignal.store( 0 );
+		control->nSpaceWaiters.store( 0 );
+		control->recycleMemory.store( 0 );
+		control->recycleCpuMs.store( 0 );
+		control->recycleAgeMs.store( 0 );
+		control->recycleInterval.store( RecyclePolicy().checkInterval );
+		control->recycleVersion.store( 0 );
+		control->poisonLimit.store( 3 );
+		control->nCrashed.store( 0 );
+		control->nPoisoned.store( 0 );
+
+		workRing = ShmRing::create( base + controlBytes, workCapacity, slotSize );
+
+		inflightBase = base + controlBytes + workBytes;
+		for(int i=0;i<nWorkers;i++){
+			inflight_t *slot = new ( inflightOf( i ) ) inflight_t();
+			slot->busy.store( busyNone );
+			slot->running.store( 0 );
+			slot->resultHead.store( 0 );
+			slot->resultTail.store( 0 );
+		}
+
+		// template이 worker의 종료와 함께 기다리는 종료 요청 이벤트
+		quitEvent = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+		if( quitEvent < 0 )
+			throw std::system_error( errno, std::generic_category(), "ProcessPool : eventfd" );
+
+		// 큰 workItem의 memfd를 넘길 worker별 소켓 ( 부모 -> worker )
+		//   worker가 자기가 요청한 fd만 받도록 worker마다 따로 둔다.
+		itemSockets.assign( nWorkers, -1 );
+		workerSockets.assign( nWorkers, -1 );
+		for(int i=0;i<nWorkers;i++){
+			int pair[2];
+
+			if( socketpair( AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, pair ) < 0 )
+				throw std::system_error( errno, std::generic_category(), "ProcessPool : socketpair" );
+			itemSockets[i] = pair[0];
+			workerSockets[i] = pair[1];
+		}
+
+		externalThreshold.store( slotSize );
+	}
+
+	inflight_t *inflightOf(int index){
+		return (inflight_t*)( inflightBase + inflightStride * index );
+	}
+	char *dataOf(inflight_t *slot){
+		return (char*)slot + dataOffset;
+	}
+	result_t *mailboxOf(inflight_t *slot){
+		return (result_t*)( (char*)slot + mailboxOffset );
+	}
+
+	/*
+		enqueueExternal
+
+		workItem을 memfd에 직렬화하고 링에는 일련번호만 넣는다.
+		memfd는 완료될 때까지 부모가 가지고 있다가, worker가 요청할 때마다 보낸다.
+	*/
+	bool enqueueExternal(const T &workItem, size_t len, uint64_t seq){
+		int fd = memfd_create( "ProcessPool", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+		if( fd < 0 )
+			throw std::system_error( errno, std::generic_category(), "ProcessPool : memfd_create" );
+
+		void *mem = MAP_FAILED;
+		if( ftruncate( fd, (off_t)len ) == 0 )
+			mem = mmap( nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+		if( mem == MAP_FAILED ){
+			int error = errno;
+			close( fd );
+			throw std::system_error( error, std::generic_category(), "ProcessPool : memfd" );
+		}
+
+		PoolCodec<T>::encode( workItem, mem );
+		munmap( mem, len );
+
+		// worker는 읽기만 하므로 내용을 봉인한다.
+		fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL );
+
+		{
+			std::unique_lock<std::mutex> guard( externalMutex );
+			externals[ seq ] = fd;
+		}
+		nExternal.fetch_add( 1 );
+
+		if( workRing->push( 0, seq | externalBit, [](void *){}, &control->quit ) )
+			return true;
+
+		releaseExternal( seq );
+		return false;
+	}
+
+	/*
+		sendExternal
+
+		seq의 memfd와 그 정보를 index번 worker의 item 소켓으로 보낸다. ( 결과 수집 쓰레드 )
+		이미 완료되어 memfd가 없으면 fd 없이 정보만 보낸다.
+
+		tag : worker가 요청한 workItem의 tag
+	*/
+	void sendExternal(int index, uint64_t tag){
+		external_t info = { tag, 0 };
+		struct iovec iov = { &info, sizeof(info) };
+		char buffer[ CMSG_SPACE( sizeof(int) ) ];
+		struct msghdr msg;
+		struct stat st;
+		int fd = -1;
+
+		{
+			std::unique_lock<std::mutex> guard( externalMutex );
+			auto it = externals.find( tag & seqMask );
+			if( it != externals.end() )
+				fd = it->second;
+		}
+		if( fd >= 0 && fstat( fd, &st ) == 0 )
+			info.len = (uint64_t)st.st_size;
+		else
+			fd = -1;
+
+		memset( &msg, 0, sizeof(msg) );
+		memset( buffer, 0, sizeof(buffer) );
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		if( fd >= 0 ){
+			msg.msg_control = buffer;
+			msg.msg_controllen = sizeof(buffer);
+
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN( sizeof(int) );
+			memcpy( CMSG_DATA( cmsg ), &fd, sizeof(int) );
+		}
+
+		// worker가 죽어 소켓이 막혀 있으면 보내지 못해도 된다. ( template이 다시 넣는다 )
+		while( sendmsg( itemSockets[index], &msg, MSG_NOSIGNAL ) < 0 ){
+			if( errno != EINTR )
+				return;
+		}
+	}
+
+	/*
+		recvExternal
+
+		item 소켓에서 tag의 memfd를 받는다.
+		앞서 죽은 worker가 요청해 두고 받지 못한 다른 tag의 memfd는 닫고 버린다.
+		memfd가 없거나 종료 요청이 오면 -1을 반환한다.
+
+		socket : worker의 item 소켓
+	*/
+	int recvExternal(int socket, uint64_t tag, external_t &info){
+		while( !control->quit.load() ){
+			struct iovec iov = { &info, sizeof(info) };
+			char buffer[ CMSG_SPACE( sizeof(int) ) ];
+			struct msghdr msg;
+			int fd = -1;
+
+			memset( &msg, 0, sizeof(msg) );
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = buffer;
+			msg.msg_controllen = sizeof(buffer);
+
+			ssize_t n = recvmsg( socket, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT );
+			if( n < 0 ){
+				if( errno == EINTR )
+					continue;
+				if( errno != EAGAIN && errno != EWOULDBLOCK )
+					return -1;
+
+				struct pollfd fds[2] = { { socket, POLLIN, 0 }, { quitEvent, POLLIN, 0 } };
+				poll( fds, 2, -1 );
+				continue;
+			}
+
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+			if( cmsg != nullptr &&
+				cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS )
+				memcpy( &fd, CMSG_DATA( cmsg ), sizeof(int) );
+
+			if( n == sizeof(info) && info.tag == tag )
+				return fd;
+			if( fd >= 0 )
+				close( fd );
+		}
+		return -1;
+	}
+
+	/*
+		drainExternal
+
+		item 소켓에 남은 memfd를 모두 닫는다. ( 죽은 worker의 자리를 채우기 전, template )
+	*/
+	static void drainExternal(int socket){
+		while( true ){
+			external_t info;
+			struct iovec iov = { &info, sizeof(info) };
+			char buffer[ CMSG_SPACE( sizeof(int) ) ];
+			struct msghdr msg;
+			int fd = -1;
+
+			memset( &msg, 0, sizeof(msg) );
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = buffer;
+			msg.msg_controllen = sizeof(buffer);
+
+			if( recvmsg( socket, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT ) < 0 ){
+				if( errno == EINTR )
+					continue;
+				return;
+			}
+
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+			if( cmsg != nullptr &&
+				cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS ){
+				memcpy( &fd, CMSG_DATA( cmsg ), sizeof(int) );
+				close( fd );
+			}
+		}
+	}
+
+	/*
+		releaseExternal
+
+		완료된 workItem의 memfd를 닫는다.
+	*/
+	void releaseExternal(uint64_t seq){
+		std::unique_lock<std::mutex> guard( externalMutex );
+
+		auto it = externals.find( seq );
+		if( it == externals.end() )
+			return;
+
+		close( it->second );
+		externals.erase( it );
+		nExternal.fetch_sub( 1 );
+	}
+
+	/*
+		postQuit
+
+		template과 worker들에게 종료를 알린다.
+	*/
+	void postQuit(){
+		uint64_t one = 1;
+
+		control->quit.store( 1 );
+		if( write( quitEvent, &one, sizeof(one) ) < 0 ){
+			// 이미 신호가 쌓여 있으면 실패해도 된다.
+		}
+
+		workRing->wakeAll();
+
+		control->resultSignal.fetch_add( 1 );
+		control->spaceSignal.fetch_add( 1 );
+		futexWake( &control->resultSignal );
+		futexWake( &control->spaceSignal );
+	}
+
+	/*
+		waitOrKill
+
+		pid가 종료하기를 deadline까지 기다리고, 넘으면 SIGKILL로 끝낸다.
+	*/
+	static void waitOrKill(pid_t pid, std::chrono::steady_clock::time_point deadline){
+		while( waitpid( pid, nullptr, WNOHANG ) == 0 ){
+			if( std::chrono::steady_clock::now() >= deadline ){
+				::kill( pid, SIGKILL );
+				waitpid( pid, nullptr, 0 );
+				return;
+			}
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		}
+	}
+
+	/*
+		spawnTemplate
+
+		worker들을 fork해 줄 template 프로세스를 fork한다.
+	*/
+	void spawnTemplate(){
+		pid_t parent = getpid();
+
+		templatePid = fork();
+		if( templatePid < 0 )
+			throw std::system_error( errno, std::generic_category(), "ProcessPool : fork" );
+
+		if( templatePid == 0 ){
+			// 부모가 죽으면 template도 같이 죽는다.
+			prctl( PR_SET_PDEATHSIG, SIGKILL );
+			if( getppid() != parent )
+				_exit( 0 );
+
+			templateMain();
+			_exit( 0 );
+		}
+	}
+
+	/*
+		templateMain
+
+		template 프로세스의 본체
+		warmup으로 상태를 올린 뒤 worker들을 fork하고,
+		종료한 worker의 자리를 다시 fork하여 채운다.
+		worker마다 pidfd를 열어 종료 요청 이벤트와 함께 poll하므로
+		죽은 worker는 바로 거두어진다. ( pidfd가 없는 커널에서는 reapInterval마다 거둔다. )
+	*/
+	void templateMain(){
+		std::vector<pid_t> workers( nWorkers, -1 );
+		std::vector<int> pidfds( nWorkers, -1 );
+
+		// 부모 쪽 소켓은 부모만 쓴다.
+		for( int fd : itemSockets )
+			close( fd );
+
+		if( warmup )
+			warmup();
+
+		for(int i=0;i<nWorkers;i++){
+			workers[i] = spawnWorker( i );
+			pidfds[i] = openPidfd( workers[i] );
+		}
+
+		while( !control->quit.load() ){
+			std::vector<struct pollfd> fds;
+			bool polling = true;
+
+			fds.push_back( { quitEvent, POLLIN, 0 } );
+			for( int fd : pidfds ){
+				if( fd >= 0 )
+					fds.push_back( { fd, POLLIN, 0 } );
+				else
+					polling = false;
+			}
+			poll( fds.data(), fds.size(), polling ? -1 : reapInterval );
+
+			siginfo_t info;
+			while( true ){
+				memset( &info, 0, sizeof(info) );
+				if( waitid( P_ALL, 0, &info, WEXITED | WNOHANG ) < 0 || info.si_pid == 0 )
+					break;
+
+				control->nAlive.fetch_sub( 1 );
+				for(int i=0;i<nWorkers;i++){
+					if( workers[i] != info.si_pid )
+						continue;
+
+					if( pidfds[i] >= 0 )
+						close( pidfds[i] );
+					workers[i] = -1;
+					pidfds[i] = -1;
+
+					recoverWorker( i, workers[i], pidfds[i] );
+					break;
+				}
+			}
+		}
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 1 );
+		for(int i=0;i<nWorkers;i++){
+			if( workers[i] > 0 )
+				waitOrKill( workers[i], deadline );
+			if( pidfds[i] >= 0 )
+				close( pidfds[i] );
+		}
+	}
+
+	/*
+		recoverWorker
+
+		index번 worker가 종료한 뒤 자리를 새 worker로 채운다.
+		죽은 worker가 잡은 채 옮기지 못한 링 슬롯은 돌려주고 그 workItem을 다시 넣는다.
+		핸들러 도중 죽었으면 처리 중이던 workItem을 다시 work 링에 넣거나,
+		poisonLimit을 넘었으면 실패로 완료시킨다.
+		핸들러는 끝났지만 결과를 mailbox에 넘기지 못했으면 대신 넘긴다.
+		mailbox는 새 worker를 fork하기 전에 쓰고, work 링에는 fork한 뒤에 넣으므로
+		링이 가득 차 있어도 막히지 않는다.
+	*/
+	void recoverWorker(int index, pid_t &worker, int &pidfd){
+		typedef std::pair<uint64_t, std::vector<char> > requeue_t;
+
+		inflight_t *slot = inflightOf( index );
+		std::vector<requeue_t> requeues;
+		uint32_t busy = slot->busy.load();
+		uint64_t tag = slot->tag;
+
+		// 잡은 링 슬롯을 inflight 슬롯으로 옮긴 뒤였으면 사본이 있으므로 돌려주기만 한다.
+		workRing->reclaim( (uint32_t)index,
+			[&](const void *data, uint32_t len, uint64_t cellTag){
+				if( busy != busyNone && cellTag == tag )
+					return;
+				requeues.emplace_back( cellTag,
+					std::vector<char>( (const char*)data, (const char*)data + len ) );
+			} );
+
+		bool ran = slot->running.load() != 0;
+		if( ran ){
+			// 핸들러를 세던 worker가 죽었으므로 대신 빼준다.
+			slot->running.store( 0 );
+			control->nWorking.fetch_sub( 1 );
+			control->nCrashed.fetch_add( 1 );
+		}
+
+		if( busy == busyResult && !published( slot ) )
+			postResult( slot, tag, slot->status );
+
+		if( busy == busyInline || busy == busyExternal ){
+			// 핸들러를 부르기 전에 죽었으면 죽인 횟수를 세지 않는다.
+			uint64_t crashes = ( tag >> crashShift ) + ( ran ? 1 : 0 );
+
+			if( crashes < (uint64_t)control->poisonLimit.load() ){
+				uint64_t requeued = ( tag & ~( (uint64_t)0xFF << crashShift ) ) | ( crashes << crashShift );
+				const char *data = dataOf( slot );
+				uint32_t len = busy == busyInline ? slot->len : 0;
+
+				requeues.emplace_back( requeued, std::vector<char>( data, data + len ) );
+			}
+			else{
+				control->nPoisoned.fetch_add( 1 );
+				postResult( slot, tag, resultPoisoned );
+			}
+		}
+		slot->busy.store( busyNone );
+
+		// 요청해 두고 받지 못한 memfd를 닫는다.
+		drainExternal( workerSockets[index] );
+
+		if( !control->quit.load() ){
+			worker = spawnWorker( index );
+			pidfd = openPidfd( worker );
+		}
+
+		for( auto &requeue : requeues ){
+			workRing->push( (uint32_t)requeue.second.size(), requeue.first,
+				[&](void *dst){
+					memcpy( dst, requeue.second.data(), requeue.second.size() );
+				}, &control->quit );
+		}
+	}
+
+	/*
+		openPidfd
+
+		pid의 pidfd를 연다. 지원하지 않는 커널이면 -1을 반환한다.
+	*/
+	static int openPidfd(pid_t pid){
+#ifdef SYS_pidfd_open
+		if( pid > 0 )
+			return (int)syscall( SYS_pidfd_open, pid, 0 );
+#endif
+		return -1;
+	}
+
+	/*
+		spawnWorker
+
+		template에서 index번 worker 프로세스를 하나 fork한다.
+	*/
+	pid_t spawnWorker(int index){
+		pid_t parent = getpid();
+		pid_t pid = fork();
+
+		if( pid < 0 )
+			return -1;
+
+		if( pid == 0 ){
+			// template이 죽으면 worker도 같이 죽는다.
+			prctl( PR_SET_PDEATHSIG, SIGKILL );
+			if( getppid() != parent )
+				_exit( 0 );
+
+			workerMain( index );
+			_exit( 0 );
+		}
+
+		control->nAlive.fetch_add( 1 );
+		return pid;
+	}
+
+	/*
+		loadRecyclePolicy
+
+		공유 메모리의 교체 조건을 복사하고 그 버전을 반환한다.
+	*/
+	uint32_t loadRecyclePolicy(RecyclePolicy &policy){
+		uint32_t version = control->recycleVersion.load();
+
+		policy.maxMemoryGrowth = (size_t)control->recycleMemory.load();
+		policy.maxCpuTimeMs = control->recycleCpuMs.load();
+		policy.maxAgeMs = control->recycleAgeMs.load();
+		policy.checkInterval = control->recycleInterval.load();
+		return version;
+	}
+
+	/*
+		workerMain
+
+		worker 프로세스의 본체
+		lifeCount만큼 workItem을 처리하거나 교체 조건을 넘으면 종료한다.
+		잡은 링 슬롯의 workItem을 inflight 슬롯에 옮기고 바로 슬롯을 돌려준 뒤,
+		핸들러는 inflight 슬롯의 사본을 그 자리에서 읽는다.
+		busy는 링 슬롯을 돌려주기 전에 세우고 결과를 mailbox에 넘긴 뒤에 내리므로
+		worker가 죽으면 template이 그 상태로 workItem을 다시 넣거나 결과를 대신 넘긴다.
+
+		index : worker의 inflight 슬롯 번호
+	*/
+	void workerMain(int index){
+		int lifeCount = lifeTime;
+		inflight_t *slot = inflightOf( index );
+
+		RecyclePolicy policy;
+		uint32_t policyVersion = loadRecyclePolicy( policy );
+		RecycleMeter meter( CLOCK_PROCESS_CPUTIME_ID, privateMemoryBytes );
+
+		while( !control->quit.load() && lifeCount > 0 ){
+			uint64_t pos;
+			bool got;
+
+			control->nWaiting.fetch_add(1);
+				got = workRing->claim( &pos, (uint32_t)index, &control->quit );
+			control->nWaiting.fetch_sub(1);
+
+			if( !got )
+				break;
+
+			workRing->read( pos,
+				[&](const void *data, uint32_t len, uint64_t tag){
+					slot->tag = tag;
+					slot->len = len;
+					if( tag & externalBit ){
+						slot->busy.store( busyExternal );
+						return;
+					}
+
+					memcpy( dataOf( slot ), data, len );
+					slot->busy.store( busyInline );
+				} );
+			workRing->release( pos );
+
+			bool result;
+			if( slot->busy.load() == busyExternal )
+				result = runExternal( index, slot );
+			else
+				result = runHandler( slot, dataOf( slot ), slot->len );
+
+			slot->status = result ? resultSucceeded : resultFailed;
+			slot->busy.store( busyResult );
+				postResult( slot, slot->tag, slot->status );
+			slot->busy.store( busyNone );
+
+			lifeCount --;
+
+			if( control->recycleVersion.load() != policyVersion )
+				policyVersion = loadRecyclePolicy( policy );
+			if( meter.expired( policy ) )
+				break;
+		}
+	}
+
+	/*
+		runExternal
+
+		부모에게 slot의 memfd를 요청하여 받아 매핑하고 핸들러를 부른다.
+	*/
+	bool runExternal(int index, inflight_t *slot){
+		external_t info;
+
+		postResult( slot, slot->tag, resultFetch );
+
+		int fd = recvExternal( workerSockets[index], slot->tag, info );
+		if( fd < 0 )
+			return false;
+
+		void *mem = mmap( nullptr, info.len, PROT_READ, MAP_SHARED, fd, 0 );
+		close( fd );
+		if( mem == MAP_FAILED )
+			return false;
+
+		bool result = runHandler( slot, mem, info.len );
+		munmap( mem, info.len );
+		return result;
+	}
+
+	/*
+		runHandler
+
+		data에 직렬화된 workItem으로 핸들러를 부른다.
+		핸들러가 view_t를 받으면 decode하지 않고 그대로 넘긴다.
+	*/
+	bool runHandler(inflight_t *slot, const void *data, size_t len){
+		bool result;
+
+		control->nWorking.fetch_add(1);
+		slot->running.store( 1 );
+			if constexpr( viewHandler )
+				result = handler( PoolCodec<T>::view( data, len ) );
+			else
+				result = handler( PoolCodec<T>::decode( data, len ) );
+		slot->running.store( 0 );
+		control->nWorking.fetch_sub(1);
+
+		return result;
+	}
+
+	/*
+		postResult
+
+		slot의 mailbox에 결과를 넣는다. mailbox가 가득 차 있으면 비워질 때까지 기다린다.
+		resultTail을 쓰는 것이 결과를 넘기는 시점이다.
+		worker( 죽은 뒤에는 template ) 하나만 부른다.
+	*/
+	void postResult(inflight_t *slot, uint64_t tag, uint32_t status){
+		uint32_t tail = slot->resultTail.load();
+
+		while( tail - slot->resultHead.load() >= mailboxDepth ){
+			uint32_t ticket = control->spaceSignal.load();
+
+			if( control->quit.load() )
+				return;
+
+			ShmRing::wait( control->spaceSignal, control->nSpaceWaiters, ticket, -1,
+				[&](){ return tail - slot->resultHead.load() < mailboxDepth; } );
+		}
+
+		result_t *result = mailboxOf( slot ) + tail % mailboxDepth;
+		result->tag = tag;
+		result->status = status;
+		slot->resultTail.store( tail + 1 );
+
+		ShmRing::notify( control->resultSignal, control->nResultWaiters );
+	}
+
+	/*
+		published
+
+		slot의 busyResult 결과가 이미 mailbox에 넘어갔는지 여부 ( template )
+		tag는 workItem을 넣을 때마다 달라지므로 마지막으로 넘긴 결과와 비교한다.
+	*/
+	bool published(inflight_t *slot){
+		uint32_t tail = slot->resultTail.load();
+
+		if( tail == 0 )
+			return false;
+
+		result_t *last = mailboxOf( slot ) + ( tail - 1 ) % mailboxDepth;
+		return last->tag == slot->tag && last->status != resultFetch;
+	}
+
+	/*
+		collectthread
+
+		부모 프로세스의 결과 수집 쓰레드
+		worker들의 mailbox를 비우며 완료 콜백을 부르고, memfd 요청에 fd를 보낸다.
+	*/
+	void collectthread(){
+		while( !control->quit.load() ){
+			uint32_t ticket = control->resultSignal.load();
+
+			if( collectResults() > 0 )
+				continue;
+
+			ShmRing::wait( control->resultSignal, control->nResultWaiters, ticket, -1,
+				[&](){ return hasResults(); } );
+		}
+	}
+
+	bool hasResults(){
+		for(int i=0;i<nWorkers;i++){
+			inflight_t *slot = inflightOf( i );
+			if( slot->resultHead.load() != slot->resultTail.load() )
+				return true;
+		}
+		return false;
+	}
+
+	/*
+		collectResults
+
+		모든 mailbox에 쌓인 결과를 처리하고 그 수를 반환한다.
+	*/
+	size_t collectResults(){
+		size_t collected = 0;
+
+		for(int i=0;i<nWorkers;i++){
+			inflight_t *slot = inflightOf( i );
+			uint32_t head = slot->resultHead.load( std::memory_order_relaxed );
+			uint32_t tail = slot->resultTail.load( std::memory_order_acquire );
+
+			for( ; head != tail; head++ ){
+				result_t result = mailboxOf( slot )[ head % mailboxDepth ];
+
+				if( result.status == resultFetch )
+					sendExternal( i, result.tag );
+				else
+					complete( result.tag, result.status );
+				collected ++;
+			}
+			slot->resultHead.store( head );
+		}
+
+		if( collected > 0 )
+			ShmRing::notify( control->spaceSignal, control->nSpaceWaiters );
+		return collected;
+	}
+
+	void complete(uint64_t tag, uint32_t status){
+		uint64_t seq = tag & seqMask;
+
+		if( nExternal.load() > 0 )
+			releaseExternal( seq );
+
+		completion_t callback;
+		{
+			std::unique_lock<std::mutex> guard( poolMutex );
+			callback = onComplete;
+		}
+		if( callback )
+			callback( seq, status == resultSucceeded );
+	}
+
+protected:
+	static const int reapInterval = 10;	// template이 종료한 worker를 거두는 주기 ( ms )
+
+	handler_t handler;
+	completion_t onComplete;	// 완료 콜백
+	warmup_t warmup;		// template 프로세스에서 한 번 호출되는 준비 함수
+
+	int nWorkers;
+	int lifeTime;
+
+	void *region;		// 공유 메모리
+	size_t regionSize;
+	char *inflightBase;	// worker별 inflight 슬롯의 시작
+	size_t inflightStride;	// inflight 슬롯 하나의 크기
+	size_t dataOffset;	// inflight 슬롯 안에서 사본의 위치 ( 64바이트 경계 )
+	size_t mailboxOffset;	// inflight 슬롯 안에서 결과 mailbox의 위치
+	int quitEvent;		// 종료 요청 eventfd
+	std::vector<int> itemSockets;	// memfd를 worker에게 보내는 부모 쪽 소켓
+	std::vector<int> workerSockets;	// worker가 memfd를 받는 소켓 ( template / worker )
+
+	std::atomic<size_t> externalThreshold;	// 이보다 큰 workItem은 memfd로 넘긴다.
+	std::unordered_map<uint64_t, int> externals;	// 완료되지 않은 memfd workItem ( seq -> fd )
+	std::atomic<int> nExternal;
+	std::mutex externalMutex;
+
+	control_t *control;	// 공유 메모리 위의 제어 블록
+	ShmRing *workRing;	// 부모 -> worker
+
+	pid_t templatePid;		// worker를 fork하는 template 프로세스
+	std::thread collector;		// 결과 수집 쓰레드
+	std::mutex poolMutex;
+
+	std::atomic<uint64_t> nextSeq;
+	std::atomic<bool> killed;
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <functional>
+#include <chrono>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+
+/*
+	RecyclePolicy
+
+	worker를 언제 새 worker로 교체할지 정하는 조건들.
+	lifeTime( 처리 횟수 )과 별개로, 측정한 값이 한도를 넘으면 worker를 교체한다.
+	0인 항목은 검사하지 않는다.
+*/
+struct RecyclePolicy{
+	RecyclePolicy() :
+		maxMemoryGrowth( 0 ), maxCpuTimeMs( 0 ), maxAgeMs( 0 ),
+		checkInterval( 16 ) {
+	}
+
+	size_t maxMemoryGrowth;	// worker 시작 후 늘어난 메모리의 한도 ( 바이트 )
+	uint64_t maxCpuTimeMs;	// worker가 쓴 CPU 시간의 한도
+	uint64_t maxAgeMs;	// worker가 살아있는 시간의 한도
+	int checkInterval;	// 몇 개의 workItem을 처리할 때마다 검사할지
+};
+
+/*
+	privateMemoryBytes
+
+	이 프로세스가 혼자 쓰는 상주 메모리의 크기.
+	fork로 물려받아 공유 중인 copy-on-write 페이지는 포함하지 않으므로
+	template에서 올린 상태를 읽기만 해서는 늘어나지 않는다.
+	( /proc/self/smaps_rollup의 Private_Clean + Private_Dirty,
+	  없으면 /proc/self/statm의 resident - shared )
+*/
+inline size_t privateMemoryBytes(){
+	size_t total = 0;
+	bool found = false;
+
+	FILE *fp = fopen( "/proc/self/smaps_rollup", "r" );
+	if( fp != nullptr ){
+		char line[256];
+		unsigned long kb;
+
+		while( fgets( line, sizeof(line), fp ) != nullptr ){
+			if( sscanf( line, "Private_Clean: %lu kB", &kb ) == 1 ||
+				sscanf( line, "Private_Dirty: %lu kB", &kb ) == 1 ){
+				total += (size_t)kb * 1024;
+				found = true;
+			}
+		}
+		fclose( fp );
+	}
+	if( found )
+		return total;
+
+	fp = fopen( "/proc/self/statm", "r" );
+	if( fp != nullptr ){
+		unsigned long size, resident, shared;
+
+		if( fscanf( fp, "%lu %lu %lu", &size, &resident, &shared ) == 3 )
+			total = (size_t)( resident - shared ) * (size_t)sysconf( _SC_PAGESIZE );
+		fclose( fp );
+	}
+	return total;
+}
+
+/*
+	heapInUseBytes
+
+	malloc이 사용 중인 힙의 크기. ( 프로세스 전체 )
+*/
+inline size_t heapInUseBytes(){
+#if defined(__GLIBC__) && ( __GLIBC__ > 2 || ( __GLIBC__ == 2 && __GLIBC_MINOR__ >= 33 ) )
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#else
+	struct mallinfo info = mallinfo();
+	return (size_t)(unsigned int)info.uordblks + (size_t)(unsigned int)info.hblkhd;
+#endif
+}
+
+/*
+	cpuTimeMs
+
+	clock의 CPU 시간 ( ms )
+*/
+inline uint64_t cpuTimeMs(clockid_t clock){
+	struct timespec ts;
+
+	clock_gettime( clock, &ts );
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+	clockNanos
+
+	clock의 현재 값 ( ns )
+*/
+inline uint64_t clockNanos(clockid_t clock){
+	struct timespec ts;
+
+	clock_gettime( clock, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/*
+	runDelayNanos
+
+	이 쓰레드가 CPU를 기다리며 run queue에 있었던 시간의 합 ( ns )
+	/proc/thread-self/schedstat을 읽을 수 없으면 0을 반환한다.
+	핸들러 호출마다 읽으므로 파일은 쓰레드마다 한 번만 열어두고 pread로 다시 읽는다.
+*/
+inline uint64_t runDelayNanos(){
+	struct schedstat_t{
+		schedstat_t() : fd( open( "/proc/thread-self/schedstat", O_RDONLY | O_CLOEXEC ) ) {
+		}
+		~schedstat_t(){
+			if( fd >= 0 )
+				close( fd );
+		}
+		int fd;
+	};
+	static thread_local schedstat_t schedstat;
+
+	char buffer[128];
+	ssize_t n = schedstat.fd >= 0 ? pread( schedstat.fd, buffer, sizeof(buffer) - 1, 0 ) : -1;
+	if( n <= 0 )
+		return 0;
+	buffer[n] = 0;
+
+	unsigned long long running = 0, waiting = 0;
+	if( sscanf( buffer, "%llu %llu", &running, &waiting ) != 2 )
+		waiting = 0;
+
+	return (uint64_t)waiting;
+}
+
+/*
+	RecycleMeter
+
+	worker 하나의 메모리 증가, CPU 시간, 나이를 재어 RecyclePolicy와 비교한다.
+	검사는 checkInterval개의 workItem마다 한 번만 측정한다.
+*/
+class RecycleMeter{
+public:
+	typedef std::function<size_t()> probe_t;
+
+	/*
+		RecycleMeter
+
+		_cpuClock : CPU 시간을 잴 clock
+		            ( 쓰레드 worker는 CLOCK_THREAD_CPUTIME_ID,
+		              프로세스 worker는 CLOCK_PROCESS_CPUTIME_ID )
+		_memoryProbe : 메모리 사용량을 재는 함수
+	*/
+	RecycleMeter(clockid_t _cpuClock, probe_t _memoryProbe) :
+		cpuClock( _cpuClock ), memoryProbe( _memoryProbe ),
+		sinceCheck( 0 ) {
+
+		baseMemory = memoryProbe ? memoryProbe() : 0;
+		baseCpu = cpuTimeMs( cpuClock );
+		born = std::chrono::steady_clock::now();
+	}
+
+	/*
+		expired
+
+		workItem 하나를 처리한 뒤 호출한다.
+		worker를 교체해야 하면 true를 반환한다.
+	*/
+	bool expired(const RecyclePolicy &policy){
+		if( policy.maxMemoryGrowth == 0 && policy.maxCpuTimeMs == 0 &&
+			policy.maxAgeMs == 0 )
+			return false;
+
+		if( ++sinceCheck < policy.checkInterval )
+			return false;
+		sinceCheck = 0;
+
+		if( policy.maxAgeMs > 0 ){
+			auto age = std::chrono::steady_clock::now() - born;
+			if( (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>( age ).count()
+				>= policy.maxAgeMs )
+				return true;
+		}
+		if( policy.maxCpuTimeMs > 0 &&
+			cpuTimeMs( cpuClock ) - baseCpu >= policy.maxCpuTimeMs )
+			return true;
+		if( policy.maxMemoryGrowth > 0 && memoryProbe ){
+			size_t now = memoryProbe();
+			if( now > baseMemory && now - baseMemory >= policy.maxMemoryGrowth )
+				return true;
+		}
+
+		return false;
+	}
+
+protected:
+	clockid_t cpuClock;
+	probe_t memoryProbe;
+
+	size_t baseMemory;	// worker 시작 시점의 메모리
+	uint64_t baseCpu;	// worker 시작 시점의 CPU 시간
+	std::chrono::steady_clock::time_point born;
+
+	int sinceCheck;
+};
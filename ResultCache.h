@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstddef>
+
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <optional>
+
+#include <mutex>
+#include <chrono>
+
+#include "ShardHash.h"
+
+/*
+	isHashable
+
+	std::hash로 해시할 수 있는 타입인지 검사한다.
+*/
+template <typename K, typename = void>
+struct isHashable : std::false_type{
+};
+template <typename K>
+struct isHashable<K,
+	decltype( (void)std::hash<K>()( std::declval<const K&>() ) )> : std::true_type{
+};
+
+/*
+	ResultCache
+
+	_IN -> _OUT 결과를 담아두는 크기 제한 캐시.
+	키의 해시로 shard를 나누어 shard마다 락을 따로 잡고,
+	shard 안에서는 CLOCK( second chance ) 방식으로 교체한다.
+	ttl이 지난 결과는 없는 것으로 취급한다.
+	K와 V는 복사 생성만 할 수 있으면 되고 기본 생성이나 대입은 필요 없다.
+*/
+template <typename K, typename V, typename Hash = std::hash<K> >
+class ResultCache{
+public:
+	typedef std::chrono::steady_clock clock_t;
+
+	/*
+		ResultCache
+
+		capacity : 캐시에 담을 결과의 최대 개수 ( shard들에 나누어진다 )
+		_ttl : 결과의 유효 시간 ( 0이면 만료되지 않음 )
+		nShard : shard의 수
+	*/
+	ResultCache(size_t capacity, std::chrono::milliseconds _ttl, int nShard = 16) :
+		ttl( _ttl ),
+		shards( nShard > 0 ? nShard : 1 ) {
+
+		size_t perShard = capacity / shards.size();
+		for( auto &shard : shards ){
+			shard.capacity = perShard > 0 ? perShard : 1;
+			shard.hand = 0;
+			shard.slots.reserve( shard.capacity );
+			shard.index.reserve( shard.capacity );
+		}
+	}
+
+	/*
+		find
+
+		key에 대한 유효한 결과가 있으면 그 복사본을, 없으면 std::nullopt를 반환한다.
+	*/
+	std::optional<V> find(const K &key){
+		size_t h = hash( key );
+		shard_t &shard = shardOf( h );
+		std::unique_lock<std::mutex> guard( shard.mutex );
+
+		auto it = shard.index.find( key );
+		if( it == shard.index.end() )
+			return std::nullopt;
+
+		slot_t &slot = shard.slots[ it->second ];
+		if( expired( slot ) ){
+			// 빈 슬롯으로 만들어 다음 교체 때 바로 재사용되게 한다.
+			shard.index.erase( it );
+			clear( slot );
+			return std::nullopt;
+		}
+
+		slot.referenced = true;
+		return slot.value;
+	}
+
+	/*
+		insert
+
+		key의 결과를 넣는다. 자리가 없으면 CLOCK으로 하나를 내보낸다.
+	*/
+	void insert(const K &key, const V &value){
+		size_t h = hash( key );
+		shard_t &shard = shardOf( h );
+		std::unique_lock<std::mutex> guard( shard.mutex );
+
+		auto it = shard.index.find( key );
+		if( it != shard.index.end() ){
+			fill( shard.slots[ it->second ], key, value );
+			return;
+		}
+
+		size_t pos;
+		if( shard.slots.size() < shard.capacity ){
+			pos = shard.slots.size();
+			shard.slots.emplace_back();
+		}
+		else{
+			pos = evict( shard );
+		}
+
+		fill( shard.slots[pos], key, value );
+		shard.index.emplace( key, pos );
+	}
+
+protected:
+	struct slot_t{
+		slot_t() : referenced( false ) {
+		}
+
+		std::optional<K> key;	// 비어 있으면 빈 슬롯
+		std::optional<V> value;
+		clock_t::time_point expire;
+		bool referenced;	// CLOCK의 reference bit
+	};
+	struct shard_t{
+		std::mutex mutex;
+		std::vector<slot_t> slots;
+		std::unordered_map<K, size_t, Hash> index;
+		size_t capacity;
+		size_t hand;		// CLOCK 바늘
+	};
+
+	bool expired(const slot_t &slot) const{
+		return ttl.count() > 0 && clock_t::now() >= slot.expire;
+	}
+
+	void fill(slot_t &slot, const K &key, const V &value){
+		slot.key.emplace( key );
+		slot.value.emplace( value );
+		slot.expire = clock_t::now() + ttl;
+		slot.referenced = false;
+	}
+	void clear(slot_t &slot){
+		slot.key.reset();
+		slot.value.reset();
+	}
+
+	/*
+		evict
+
+		CLOCK 바늘을 돌려 내보낼 슬롯을 고르고 그 위치를 반환한다.
+		빈 슬롯이나 만료된 슬롯은 바로 고른다.
+	*/
+	size_t evict(shard_t &shard){
+		while( true ){
+			size_t pos = shard.hand;
+			slot_t &slot = shard.slots[pos];
+
+			shard.hand = ( shard.hand + 1 ) % shard.slots.size();
+
+			if( !slot.key )
+				return pos;
+			if( slot.referenced && !expired( slot ) ){
+				slot.referenced = false;
+				continue;
+			}
+
+			shard.index.erase( *slot.key );
+			clear( slot );
+			return pos;
+		}
+	}
+
+	size_t hash(const K &key) const{
+		return Hash()( key );
+	}
+	shard_t &shardOf(size_t h){
+		return shards[ shardIndex( h, shards.size() ) ];
+	}
+
+protected:
+	std::chrono::milliseconds ttl;
+	std::vector<shard_t> shards;
+};
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+
+#include <new>
+#include <utility>
+#include <type_traits>
+
+/*
+	ScratchArena
+
+	worker 하나가 전용으로 쓰는 monotonic 할당기.
+	allocate는 포인터를 밀어 올리기만 하고 개별 해제는 없다.
+	풀이 workItem( 또는 일정 개수의 workItem )을 처리한 뒤 reset으로
+	한 번에 되감으므로, 핸들러 안의 임시 버퍼에 malloc/free가 필요 없다.
+
+	쓰레드 안전하지 않다. 한 worker 안에서만 사용해야 한다.
+*/
+class ScratchArena{
+public:
+	/*
+		ScratchArena
+
+		_chunkSize : 새 chunk를 잡을 때의 기본 크기
+		_retainSize : reset 후에도 해제하지 않고 남겨둘 chunk 용량의 합
+	*/
+	ScratchArena(size_t _chunkSize = 64 * 1024, size_t _retainSize = 1024 * 1024) :
+		chunkSize( _chunkSize ), retainSize( _retainSize ),
+		head( nullptr ), current( nullptr ), offset( 0 ),
+		usedBytes( 0 ) {
+	}
+	~ScratchArena(){
+		release();
+	}
+
+	ScratchArena(const ScratchArena &) = delete;
+	ScratchArena &operator=(const ScratchArena &) = delete;
+
+	/*
+		allocate
+
+		size 바이트를 align 정렬로 할당한다.
+		다음 reset 까지 유효하다.
+	*/
+	void *allocate(size_t size, size_t align = alignof(std::max_align_t)){
+		while( current != nullptr ){
+			void *p = bump( current, size, align );
+			if( p != nullptr )
+				return p;
+
+			// reset 후 남겨둔 chunk가 있으면 이어서 사용
+			if( current->next == nullptr )
+				break;
+			current = current->next;
+			offset = 0;
+		}
+
+		// size가 너무 크면 need가 넘쳐 작은 chunk를 잡게 된다.
+		if( size > SIZE_MAX - align - sizeof(chunk_t) )
+			throw std::bad_alloc();
+
+		size_t need = size + align + sizeof(chunk_t);
+		chunk_t *chunk = newChunk( need > chunkSize ? need : chunkSize );
+
+		if( current == nullptr )
+			head = chunk;
+		else{
+			chunk->next = current->next;
+			current->next = chunk;
+		}
+		current = chunk;
+		offset = 0;
+
+		return bump( current, size, align );
+	}
+
+	/*
+		create
+
+		U를 arena 위에 생성한다.
+		소멸자가 호출되지 않으므로 trivially destructible 타입만 허용한다.
+	*/
+	template <typename U, typename... Args>
+	U *create(Args&&... args){
+		static_assert( std::is_trivially_destructible<U>::value,
+			"ScratchArena : only trivially destructible types can be created" );
+
+		return new ( allocate( sizeof(U), alignof(U) ) )
+			U( std::forward<Args>(args)... );
+	}
+
+	/*
+		reset
+
+		모든 할당을 되감는다.
+		retainSize를 넘는 chunk들은 해제( trim )한다.
+	*/
+	void reset(){
+		size_t kept = 0;
+		chunk_t **link = &head;
+
+		while( *link != nullptr ){
+			chunk_t *chunk = *link;
+
+			if( kept + chunk->size <= retainSize ){
+				kept += chunk->size;
+				link = &chunk->next;
+			}
+			else{
+				*link = chunk->next;
+				std::free( chunk );
+			}
+		}
+
+		current = head;
+		offset = 0;
+		usedBytes = 0;
+	}
+
+	/*
+		release
+
+		모든 chunk를 해제한다.
+	*/
+	void release(){
+		while( head != nullptr ){
+			chunk_t *next = head->next;
+			std::free( head );
+			head = next;
+		}
+
+		current = nullptr;
+		offset = 0;
+		usedBytes = 0;
+	}
+
+	/*
+		used
+
+		마지막 reset 이후 할당된 바이트 수
+	*/
+	size_t used() const{
+		return usedBytes;
+	}
+
+protected:
+	struct chunk_t{
+		chunk_t *next;
+		size_t size;	// chunk_t 헤더를 포함한 크기
+	};
+
+	chunk_t *newChunk(size_t size){
+		chunk_t *chunk = (chunk_t*)std::malloc( size );
+		if( chunk == nullptr )
+			throw std::bad_alloc();
+
+		chunk->next = nullptr;
+		chunk->size = size;
+		return chunk;
+	}
+
+	void *bump(chunk_t *chunk, size_t size, size_t align){
+		uintptr_t base = (uintptr_t)( chunk + 1 );
+		uintptr_t end = (uintptr_t)chunk + chunk->size;
+		uintptr_t p = ( base + offset + align - 1 ) & ~(uintptr_t)( align - 1 );
+
+		if( p > end || size > end - p )
+			return nullptr;
+
+		offset = p + size - base;
+		usedBytes += size;
+		return (void*)p;
+	}
+
+protected:
+	size_t chunkSize;
+	size_t retainSize;
+
+	chunk_t *head;		// chunk 목록
+	chunk_t *current;	// 할당 중인 chunk
+	size_t offset;		// current 안에서의 오프셋
+
+	size_t usedBytes;
+};
+
+/*
+	ArenaAllocator
+
+	std 컨테이너를 ScratchArena 위에 올리기 위한 allocator.
+	deallocate는 아무것도 하지 않는다.
+
+		std::vector<char, ArenaAllocator<char>> buf( ArenaAllocator<char>( arena ) );
+*/
+template <typename U>
+class ArenaAllocator{
+public:
+	typedef U value_type;
+
+	ArenaAllocator(ScratchArena &_arena) :
+		arena( &_arena ){
+	}
+	template <typename V>
+	ArenaAllocator(const ArenaAllocator<V> &other) :
+		arena( other.arena ){
+	}
+
+	U *allocate(size_t n){
+		if( n > SIZE_MAX / sizeof(U) )
+			throw std::bad_alloc();
+
+		return (U*)arena->allocate( n * sizeof(U), alignof(U) );
+	}
+	void deallocate(U *, size_t){
+	}
+
+	template <typename V>
+	bool operator==(const ArenaAllocator<V> &other) const{
+		return arena == other.arena;
+	}
+	template <typename V>
+	bool operator!=(const ArenaAllocator<V> &other) const{
+		return arena != other.arena;
+	}
+
+	ScratchArena *arena;
+};
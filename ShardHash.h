@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+	shardIndex
+
+	키의 해시로 nShard개의 shard 중 하나를 고른다.
+	std::hash는 정수에 대해 항등 함수일 수 있으므로 섞어서 상위 비트를 쓴다.
+
+	h : 키의 해시
+	nShard : shard의 수 ( 0보다 커야 한다 )
+*/
+inline size_t shardIndex(size_t h, size_t nShard){
+	h ^= h >> 17;
+	h *= (size_t)0x9E3779B97F4A7C15ull;
+	return ( h >> ( sizeof(size_t) * 4 ) ) % nShard;
+}
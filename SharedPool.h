@@ -0,0 +1,544 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+
+#include <functional>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PoolCodec.h"
+#include "ShmRing.h"
+#include "DynamicProcessPool.h"
+
+/*
+	SharedPoolSegment
+
+	SharedPoolServer와 SharedPoolClient가 함께 매핑하는 이름 있는 공유 메모리의 구조.
+
+		[ header_t ][ 제출 링 ][ client_t + 완료 링 ] * maxClients
+
+	제출 링은 모든 client가 넣고 server가 꺼내는 MPMC 링이고,
+	완료 링은 client마다 하나씩 있어 server가 넣고 그 client만 꺼낸다.
+
+	링 tag는 [ client 번호 16비트 ][ 세대 8비트 ][ 일련번호 40비트 ]로 나눈다.
+	세대는 client 자리가 새 client에게 넘어갈 때마다 바뀌어,
+	죽은 client 앞으로 늦게 도착한 결과가 새 client에게 섞이지 않게 한다.
+*/
+struct SharedPoolSegment{
+	static const uint32_t magicValue = 0x53504f4c;	// 'SPOL'
+
+	static const int clientShift = 48;
+	static const int generationShift = 40;
+	static const uint64_t seqMask = ( (uint64_t)1 << generationShift ) - 1;
+
+	struct header_t{
+		uint32_t magic;
+		uint32_t maxClients;
+		uint64_t submitOffset;	// 제출 링의 위치
+		uint64_t clientOffset;	// 첫 client_t의 위치
+		uint64_t clientStride;	// client_t + 완료 링의 크기
+
+		std::atomic<uint32_t> ready;	// 초기화가 끝나면 1
+		std::atomic<uint32_t> quit;	// server 종료 플래그
+	};
+
+	struct client_t{
+		std::atomic<uint32_t> state;	// 0 : 빈 자리, 1 : 사용 중
+		std::atomic<uint32_t> generation;	// 자리를 새로 잡을 때마다 증가
+		std::atomic<int> pid;		// 자리를 잡은 client 프로세스
+		std::atomic<uint32_t> quit;	// client 종료 플래그 ( 완료 링 대기를 깨운다 )
+		// 뒤에 완료 링이 온다.
+	};
+
+	static size_t alignUp(size_t n){
+		return ( n + 63 ) & ~(size_t)63;
+	}
+
+	static uint64_t makeTag(uint32_t client, uint32_t generation, uint64_t seq){
+		return ( (uint64_t)client << clientShift ) |
+			( (uint64_t)( generation & 0xff ) << generationShift ) | ( seq & seqMask );
+	}
+	static uint32_t clientOf(uint64_t tag){
+		return (uint32_t)( tag >> clientShift );
+	}
+	static uint32_t generationOf(uint64_t tag){
+		return (uint32_t)( tag >> generationShift ) & 0xff;
+	}
+
+	SharedPoolSegment() :
+		region( MAP_FAILED ), regionSize( 0 ), header( nullptr ), submitRing( nullptr ) {
+	}
+
+	client_t *clientAt(uint32_t index){
+		return (client_t*)( (char*)region + header->clientOffset + header->clientStride * index );
+	}
+	ShmRing *completionRing(uint32_t index){
+		return ShmRing::attach( (char*)clientAt( index ) + alignUp( sizeof(client_t) ) );
+	}
+
+	void unmap(){
+		if( region != MAP_FAILED )
+			munmap( region, regionSize );
+		region = MAP_FAILED;
+	}
+
+	void *region;
+	size_t regionSize;
+
+	header_t *header;
+	ShmRing *submitRing;	// client들 -> server
+};
+
+/*
+	SharedPoolServer
+
+	같은 호스트의 여러 프로세스가 함께 쓰는 하나의 풀.
+	프로세스마다 따로 풀을 두어 호스트 전체가 과도하게 쓰레드를 만드는 대신,
+	한 프로세스가 server로 풀을 돌리고 다른 프로세스들은 SharedPoolClient로
+	이름 있는 공유 메모리( shm_open )의 제출 링에 workItem을 넣는다.
+
+	server는 수신 쓰레드가 제출 링을 비우며 내부의 DynamicProcessPool에 넣고,
+	핸들러의 결과는 그 workItem을 넣은 client의 완료 링으로 돌려준다.
+
+	T : workItem의 타입 ( PoolCodec<T>가 있어야 한다 )
+*/
+template <typename T>
+class SharedPoolServer{
+public:
+	typedef std::function<bool(T)>	handler_t;
+
+	typedef struct{
+		T item;
+		uint64_t tag;	// 제출 링 tag ( client, 세대, 일련번호 )
+	} request_t;
+
+	/*
+		SharedPoolServer
+
+		_name : 공유 메모리의 이름 ( "/로 시작하는 이름", 이미 있으면 새로 만든다 )
+		_initialWorkers : 처음에 가지고 시작할 worker의 수
+		_maxWorker : 최대 가질 수 있는 worker의 수
+		_lifeTime : 한 개의 worker가 일을 몇 번 수행할지 횟수
+		_handler : workItem을 핸들링할 핸들러
+		_maxClients : 동시에 붙을 수 있는 client 프로세스의 수
+		_slotSize : 제출 링 슬롯 하나의 크기 ( 직렬화된 workItem의 최대 크기 )
+		_capacity : 제출 링과 완료 링에 담을 수 있는 항목의 수
+	*/
+	SharedPoolServer( const std::string &_name,
+			  int _initialWorkers, int _maxWorker, int _lifeTime,
+			  handler_t _handler, uint32_t _maxClients = 16,
+			  uint32_t _slotSize = 4096, uint32_t _capacity = 1024 ) :
+		name( _name ), handler( _handler ) {
+
+		static_assert( PoolCodec<T>::supported,
+			"SharedPoolServer : workItem requires a PoolCodec<T> specialization" );
+		static_assert( PoolCodecCheck<T>::checked,
+			"SharedPoolServer : items come from other processes, so PoolCodec<T> must provide valid()" );
+
+		createSegment( _maxClients, _slotSize, _capacity );
+
+		pool.reset( new pool_t( _initialWorkers, _maxWorker, _lifeTime,
+			[this](request_t request){
+				bool result = handler( std::move( request.item ) );
+				complete( request.tag, result );
+				return result;
+			}) );
+
+		receiver = std::thread( &SharedPoolServer::receivethread, this );
+	}
+	virtual ~SharedPoolServer(){
+		kill();
+
+		shm_unlink( name.c_str() );
+		segment.unmap();
+	}
+
+	SharedPoolServer(const SharedPoolServer &) = delete;
+	SharedPoolServer &operator=(const SharedPoolServer &) = delete;
+
+	/*
+		queryPoolStatus
+
+		내부 풀의 상태를 얻어온다.
+
+		waiting : waiting중인 worker의 수를 받아올 포인터
+		working : working중인 worker의 수를 받아올 포인터
+	*/
+	void queryPoolStatus(int *waiting,int *working){
+		pool->queryPoolStatus( waiting, working );
+	}
+
+	/*
+		kill
+
+		제출을 막고 모든 worker를 죽인다. 붙어있는 client들은 enqueue에서 0을 받는다.
+	*/
+	void kill(){
+		if( segment.header->quit.exchange( 1 ) )
+			return;
+
+		segment.submitRing->wakeAll();
+		receiver.join();
+
+		pool->kill();
+
+		for(uint32_t i=0;i<segment.header->maxClients;i++){
+			segment.clientAt( i )->quit.store( 1 );
+			segment.completionRing( i )->wakeAll();
+		}
+	}
+
+protected:
+	typedef DynamicProcessPool<request_t, std::function<bool(request_t)> > pool_t;
+
+	/*
+		createSegment
+
+		이름 있는 공유 메모리를 만들고 링들을 초기화한다.
+	*/
+	void createSegment(uint32_t maxClients, uint32_t slotSize, uint32_t capacity){
+		typedef SharedPoolSegment seg;
+
+		if( maxClients == 0 || maxClients > 0xffff )
+			throw std::invalid_argument( "SharedPoolServer : maxClients must be in 1..65535" );
+
+		size_t headerBytes = seg::alignUp( sizeof(seg::header_t) );
+		size_t submitBytes = seg::alignUp( ShmRing::bytesFor( capacity, slotSize ) );
+		size_t clientStride = seg::alignUp( sizeof(seg::client_t) ) +
+			seg::alignUp( ShmRing::bytesFor( capacity, sizeof(uint32_t) ) );
+
+		segment.regionSize = headerBytes + submitBytes + clientStride * maxClients;
+
+		// 이전 server가 남긴 같은 이름의 공유 메모리는 지우고 새로 만든다.
+		shm_unlink( name.c_str() );
+		int fd = shm_open( name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600 );
+		if( fd < 0 )
+			throw std::system_error( errno, std::generic_category(), "SharedPoolServer : shm_open" );
+
+		if( ftruncate( fd, (off_t)segment.regionSize ) == 0 )
+			segment.region = mmap( nullptr, segment.regionSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0 );
+		int error = errno;
+		close( fd );
+
+		if( segment.region == MAP_FAILED ){
+			shm_unlink( name.c_str() );
+			throw std::system_error( error, std::generic_category(), "SharedPoolServer : mmap" );
+		}
+
+		char *base = (char*)segment.region;
+
+		segment.header = new ( base ) seg::header_t();
+		segment.header->magic = seg::magicValue;
+		segment.header->maxClients = maxClients;
+		segment.header->submitOffset = headerBytes;
+		segment.header->clientOffset = headerBytes + submitBytes;
+		segment.header->clientStride = clientStride;
+		segment.header->quit.store( 0 );
+
+		segment.submitRing = ShmRing::create( base + headerBytes, capacity, slotSize );
+
+		for(uint32_t i=0;i<maxClients;i++){
+			seg::client_t *client = new ( segment.clientAt( i ) ) seg::client_t();
+			client->state.store( 0 );
+			client->generation.store( 0 );
+			client->pid.store( 0 );
+			client->quit.store( 0 );
+
+			ShmRing::create( (char*)client + seg::alignUp( sizeof(seg::client_t) ),
+				capacity, sizeof(uint32_t) );
+		}
+
+		segment.header->ready.store( 1 );
+	}
+
+	/*
+		receivethread
+
+		제출 링을 비우며 workItem을 내부 풀에 넣는 쓰레드
+	*/
+	void receivethread(){
+		while( !segment.header->quit.load() ){
+			request_t request;
+			bool decoded = false;
+			bool got = segment.submitRing->pop(
+				[&](const void *data, uint32_t len, uint64_t tag){
+					// 길이는 client가 쓴 값이므로 슬롯과 인코딩에 맞는지 확인한다.
+					decoded = len <= segment.submitRing->slotSize() &&
+						PoolCodecCheck<T>::tryDecode( data, len, &request.item );
+					request.tag = tag;
+				}, &segment.header->quit );
+
+			if( !got )
+				continue;
+
+			if( decoded )
+				pool->enqueue( std::move( request ) );
+			else
+				complete( request.tag, false );
+		}
+	}
+
+	/*
+		complete
+
+		결과를 workItem을 넣은 client의 완료 링에 넣는다.
+		client가 떠났거나 자리가 다른 client에게 넘어갔으면 버린다.
+		완료 링이 가득 차 있으면 client가 비울 때까지 기다리되,
+		client 프로세스가 죽었으면 버린다.
+	*/
+	void complete(uint64_t tag, bool result){
+		typedef SharedPoolSegment seg;
+
+		uint32_t index = seg::clientOf( tag );
+		if( index >= segment.header->maxClients )
+			return;
+
+		seg::client_t *client = segment.clientAt( index );
+		ShmRing *ring = segment.completionRing( index );
+		uint32_t status = result ? 1 : 0;
+
+		while( true ){
+			if( client->state.load() == 0 ||
+				( client->generation.load() & 0xff ) != seg::generationOf( tag ) )
+				return;
+
+			if( ring->tryPush( sizeof(status), tag,
+				[&](void *dst){
+					memcpy( dst, &status, sizeof(status) );
+				}) )
+				return;
+
+			if( segment.header->quit.load() || ::kill( client->pid.load(), 0 ) < 0 )
+				return;
+			std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+		}
+	}
+
+protected:
+	std::string name;		// 공유 메모리의 이름
+	handler_t handler;
+
+	SharedPoolSegment segment;
+	std::unique_ptr<pool_t> pool;	// 실제로 workItem을 처리하는 풀
+	std::thread receiver;		// 제출 링 수신 쓰레드
+};
+
+/*
+	SharedPoolClient
+
+	SharedPoolServer의 공유 메모리에 붙어 workItem을 넣는 쪽.
+	생성 시 빈 client 자리를 하나 잡고, 그 자리의 완료 링을 결과 수집 쓰레드가 비우며
+	완료 콜백을 부른다. 죽은 client가 잡고 있던 자리는 다른 client가 다시 쓸 수 있다.
+
+	T : workItem의 타입 ( server와 같은 PoolCodec<T>를 써야 한다 )
+*/
+template <typename T>
+class SharedPoolClient{
+public:
+	typedef std::function<void(uint64_t, bool)>	completion_t;
+
+	/*
+		SharedPoolClient
+
+		_name : server가 만든 공유 메모리의 이름
+	*/
+	SharedPoolClient(const std::string &_name) :
+		nextSeq( 1 ), killed( false ) {
+
+		static_assert( PoolCodec<T>::supported,
+			"SharedPoolClient : workItem requires a PoolCodec<T> specialization" );
+
+		attachSegment( _name );
+		claimClient();
+
+		collector = std::thread( &SharedPoolClient::collectthread, this );
+	}
+	virtual ~SharedPoolClient(){
+		kill();
+
+		segment.unmap();
+	}
+
+	SharedPoolClient(const SharedPoolClient &) = delete;
+	SharedPoolClient &operator=(const SharedPoolClient &) = delete;
+
+	/*
+		enqueue
+
+		workItem을 제출 링에 직렬화하여 넣는다.
+		링이 가득 차 있으면 자리가 날 때까지 블록된다.
+
+		workItem : 넣을 workItem
+		반환값 : 완료 콜백에서 workItem을 구분할 일련번호 ( server가 종료 중이면 0 )
+	*/
+	uint64_t enqueue(const T &workItem){
+		size_t len = PoolCodec<T>::encodedSize( workItem );
+		if( len > segment.submitRing->slotSize() )
+			throw std::length_error( "SharedPoolClient : workItem is larger than a ring slot" );
+
+		uint64_t seq = nextSeq.fetch_add( 1 ) & SharedPoolSegment::seqMask;
+		uint64_t tag = SharedPoolSegment::makeTag( index, generation, seq );
+
+		bool pushed = segment.submitRing->push( (uint32_t)len, tag,
+			[&](void *dst){
+				PoolCodec<T>::encode( workItem, dst );
+			}, &segment.header->quit );
+
+		return pushed ? seq : 0;
+	}
+
+	/*
+		setCompletionHandler
+
+		server가 이 client의 workItem을 처리할 때마다 호출될 콜백을 지정한다.
+		콜백은 결과 수집 쓰레드에서 ( 일련번호, 핸들러의 반환값 ) 으로 호출된다.
+	*/
+	void setCompletionHandler(completion_t _onComplete){
+		std::unique_lock<std::mutex> guard( clientMutex );
+		onComplete = _onComplete;
+	}
+
+	/*
+		kill
+
+		결과 수집을 멈추고 client 자리를 돌려준다.
+	*/
+	void kill(){
+		if( killed.exchange( true ) )
+			return;
+
+		SharedPoolSegment::client_t *client = segment.clientAt( index );
+
+		client->quit.store( 1 );
+		segment.completionRing( index )->wakeAll();
+		collector.join();
+
+		client->pid.store( 0 );
+		client->state.store( 0 );
+	}
+
+protected:
+	/*
+		attachSegment
+
+		server가 만든 공유 메모리를 매핑한다.
+	*/
+	void attachSegment(const std::string &name){
+		int fd = shm_open( name.c_str(), O_RDWR | O_CLOEXEC, 0 );
+		if( fd < 0 )
+			throw std::system_error( errno, std::generic_category(), "SharedPoolClient : shm_open" );
+
+		struct stat st;
+		if( fstat( fd, &st ) == 0 && (size_t)st.st_size >= sizeof(SharedPoolSegment::header_t) ){
+			segment.regionSize = (size_t)st.st_size;
+			segment.region = mmap( nullptr, segment.regionSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0 );
+		}
+		int error = errno;
+		close( fd );
+
+		if( segment.region == MAP_FAILED )
+			throw std::system_error( error, std::generic_category(), "SharedPoolClient : mmap" );
+
+		segment.header = (SharedPoolSegment::header_t*)segment.region;
+		if( segment.header->magic != SharedPoolSegment::magicValue ||
+			segment.header->ready.load() == 0 ){
+			segment.unmap();
+			throw std::runtime_error( "SharedPoolClient : segment is not a shared pool" );
+		}
+
+		segment.submitRing = ShmRing::attach( (char*)segment.region + segment.header->submitOffset );
+	}
+
+	/*
+		claimClient
+
+		빈 client 자리를 잡는다. 잡힌 자리라도 주인 프로세스가 죽었으면 가져온다.
+	*/
+	void claimClient(){
+		int self = getpid();
+
+		for(uint32_t i=0;i<segment.header->maxClients;i++){
+			SharedPoolSegment::client_t *client = segment.clientAt( i );
+			uint32_t state = 0;
+
+			if( !client->state.compare_exchange_strong( state, 1 ) ){
+				int owner = client->pid.load();
+				if( owner == 0 || ::kill( owner, 0 ) == 0 || errno != ESRCH ||
+					!client->pid.compare_exchange_strong( owner, self ) )
+					continue;
+			}
+
+			index = i;
+			generation = client->generation.fetch_add( 1 ) + 1;
+			client->pid.store( self );
+			client->quit.store( 0 );
+
+			// 이전 주인 앞으로 남은 결과를 버린다.
+			ShmRing *ring = segment.completionRing( i );
+			while( ring->tryPop( [](const void *, uint32_t, uint64_t){} ) );
+			return;
+		}
+
+		segment.unmap();
+		throw std::runtime_error( "SharedPoolClient : no free client slot" );
+	}
+
+	/*
+		collectthread
+
+		완료 링을 비우며 완료 콜백을 부르는 쓰레드
+	*/
+	void collectthread(){
+		SharedPoolSegment::client_t *client = segment.clientAt( index );
+		ShmRing *ring = segment.completionRing( index );
+
+		while( !client->quit.load() ){
+			ring->pop(
+				[&](const void *data, uint32_t, uint64_t tag){
+					uint32_t status;
+					memcpy( &status, data, sizeof(status) );
+
+					if( SharedPoolSegment::generationOf( tag ) != ( generation & 0xff ) )
+						return;
+
+					completion_t callback;
+					{
+						std::unique_lock<std::mutex> guard( clientMutex );
+						callback = onComplete;
+					}
+					if( callback )
+						callback( tag & SharedPoolSegment::seqMask, status != 0 );
+				}, &client->quit );
+		}
+	}
+
+protected:
+	SharedPoolSegment segment;
+
+	uint32_t index;		// 잡은 client 자리
+	uint32_t generation;	// 자리를 잡을 때의 세대
+
+	completion_t onComplete;	// 완료 콜백
+	std::thread collector;		// 결과 수집 쓰레드
+	std::mutex clientMutex;
+
+	std::atomic<uint64_t> nextSeq;
+	std::atomic<bool> killed;
+};
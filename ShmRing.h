@@ -0,0 +1,418 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+#include <ctime>
+
+#include <atomic>
+#include <new>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+	futexWait / futexWake
+
+	공유 메모리 위의 32비트 word로 프로세스 사이에서 기다리고 깨운다.
+	FUTEX_PRIVATE_FLAG를 쓰지 않으므로 다른 프로세스의 매핑에서도 동작한다.
+
+	timeoutMs : 기다릴 최대 시간 ( 음수면 무한히 기다린다 )
+*/
+inline void futexWait(std::atomic<uint32_t> *word, uint32_t expected, int timeoutMs = -1){
+	struct timespec ts, *pts = nullptr;
+
+	if( timeoutMs >= 0 ){
+		ts.tv_sec = timeoutMs / 1000;
+		ts.tv_nsec = (long)( timeoutMs % 1000 ) * 1000000L;
+		pts = &ts;
+	}
+	syscall( SYS_futex, (uint32_t*)word, FUTEX_WAIT, expected, pts, nullptr, 0 );
+}
+inline void futexWake(std::atomic<uint32_t> *word, int count = INT_MAX){
+	syscall( SYS_futex, (uint32_t*)word, FUTEX_WAKE, count, nullptr, nullptr, 0 );
+}
+
+/*
+	ShmRing
+
+	공유 메모리 위에 놓이는 고정 크기 슬롯의 bounded MPMC 링.
+	( Vyukov의 bounded MPMC 큐 )
+
+	여러 프로세스가 같은 링을 서로 다른 주소로 매핑해도 되도록
+	슬롯 위치는 링 헤더로부터의 오프셋으로만 계산한다.
+	데이터는 writer / reader 콜백이 슬롯 위에서 직접 쓰고 읽으므로
+	직렬화 외의 복사가 없다.
+
+	비어있거나 가득 찬 링에서 기다리는 쪽은 futex로 잠든다.
+
+	꺼내는 쪽은 슬롯의 seq를 "owner가 잡음"으로 한 번에 바꾸어 슬롯을 잡으므로,
+	잡은 직후에 그 프로세스가 죽어도 reclaim으로 owner의 슬롯을 찾아 돌려줄 수 있다.
+	owner는 capacity - 2보다 작아야 한다.
+	슬롯의 데이터는 16바이트 경계에 놓인다.
+*/
+class ShmRing{
+public:
+	/*
+		bytesFor
+
+		capacity개의 slotSize 바이트 슬롯을 가진 링에 필요한 메모리 크기
+		capacity는 2의 거듭제곱으로 올림된다.
+	*/
+	static size_t bytesFor(uint32_t capacity, uint32_t slotSize){
+		return sizeof(ShmRing) + (size_t)roundCapacity( capacity ) * cellSize( slotSize );
+	}
+
+	/*
+		create
+
+		mem 위에 링을 초기화한다. mem은 bytesFor 만큼의 크기여야 한다.
+	*/
+	static ShmRing *create(void *mem, uint32_t capacity, uint32_t slotSize){
+		ShmRing *ring = new ( mem ) ShmRing();
+
+		ring->capacity = roundCapacity( capacity );
+		ring->mask = ring->capacity - 1;
+		ring->slotBytes = slotSize;
+		ring->stride = cellSize( slotSize );
+
+		for( uint32_t i=0;i<ring->capacity;i++ )
+			new ( ring->cell( i ) ) cell_t( i );
+
+		return ring;
+	}
+	/*
+		attach
+
+		이미 초기화된 링을 가리킨다.
+	*/
+	static ShmRing *attach(void *mem){
+		return (ShmRing*)mem;
+	}
+
+	uint32_t slotSize() const{
+		return slotBytes;
+	}
+	/*
+		size
+
+		링에 들어있는 항목 수의 근사값
+	*/
+	size_t size() const{
+		uint64_t t = tail.load( std::memory_order_relaxed );
+		uint64_t h = head.load( std::memory_order_relaxed );
+		return t > h ? (size_t)( t - h ) : 0;
+	}
+
+	/*
+		tryPush
+
+		빈 슬롯을 하나 잡아 writer( void *dst )로 len 바이트를 채운다.
+		링이 가득 찼거나 len이 슬롯보다 크면 false를 반환한다.
+
+		tag : 항목과 함께 전달할 값
+	*/
+	template <typename F>
+	bool tryPush(uint32_t len, uint64_t tag, F writer){
+		if( len > slotBytes )
+			return false;
+
+		uint64_t pos = tail.load( std::memory_order_relaxed );
+		cell_t *c;
+
+		while( true ){
+			c = cell( pos & mask );
+			uint64_t seq = c->seq.load( std::memory_order_acquire );
+			int64_t diff = (int64_t)seq - (int64_t)pos;
+
+			if( diff == 0 ){
+				if( tail.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+					break;
+			}
+			else if( diff < 0 )
+				return false;
+			else
+				pos = tail.load( std::memory_order_relaxed );
+		}
+
+		c->len = len;
+		c->tag = tag;
+		writer( (void*)( c + 1 ) );
+		c->seq.store( pos + 1, std::memory_order_release );
+
+		notify( itemSignal, nItemWaiters );
+		return true;
+	}
+
+	/*
+		tryPop
+
+		가장 앞의 항목을 reader( const void *data, uint32_t len, uint64_t tag )로 읽는다.
+		링이 비어있으면 false를 반환한다.
+	*/
+	template <typename F>
+	bool tryPop(F reader){
+		uint64_t pos;
+
+		if( !tryClaim( &pos, 0 ) )
+			return false;
+
+		read( pos, reader );
+		release( pos );
+		return true;
+	}
+
+	/*
+		tryClaim
+
+		가장 앞의 항목을 링에서 꺼내되 그 슬롯은 release할 때까지 돌려주지 않는다.
+		잡고 있는 동안 슬롯의 데이터는 read로 그 자리에서 읽을 수 있다.
+		링이 비어있으면 false를 반환한다.
+
+		슬롯의 seq를 pos + 2 + owner로 바꾸는 것이 잡는 시점이고, head는 그 뒤에
+		잡은 쪽이나 다음에 꺼내는 쪽이 넘겨준다. 그래서 잡은 쪽이 바로 죽어도
+		링이 멈추지 않고, 잡힌 슬롯은 reclaim으로 찾을 수 있다.
+
+		pos : 잡은 슬롯의 위치를 받아올 포인터
+		owner : 잡는 쪽의 번호 ( capacity - 2보다 작아야 한다 )
+	*/
+	bool tryClaim(uint64_t *pos, uint32_t owner){
+		uint64_t p = head.load( std::memory_order_relaxed );
+
+		while( true ){
+			cell_t *c = cell( p & mask );
+			uint64_t seq = c->seq.load( std::memory_order_acquire );
+			int64_t diff = (int64_t)seq - (int64_t)( p + 1 );
+
+			if( diff == 0 ){
+				if( c->seq.compare_exchange_weak( seq, p + 2 + owner, std::memory_order_acquire ) ){
+					head.compare_exchange_strong( p, p + 1, std::memory_order_relaxed );
+					break;
+				}
+			}
+			else if( diff < 0 )
+				return false;
+			else{
+				// 이미 누가 잡은 슬롯이면 head를 대신 넘긴다.
+				head.compare_exchange_weak( p, p + 1, std::memory_order_relaxed );
+			}
+			p = head.load( std::memory_order_relaxed );
+		}
+
+		*pos = p;
+		return true;
+	}
+
+	/*
+		read
+
+		잡고 있는 pos의 슬롯을 reader( const void *data, uint32_t len, uint64_t tag )로 읽는다.
+	*/
+	template <typename F>
+	void read(uint64_t pos, F reader){
+		cell_t *c = cell( pos & mask );
+		reader( (const void*)( c + 1 ), c->len, c->tag );
+	}
+
+	/*
+		release
+
+		잡고 있던 pos의 슬롯을 돌려준다.
+	*/
+	void release(uint64_t pos){
+		cell( pos & mask )->seq.store( pos + mask + 1, std::memory_order_release );
+
+		notify( spaceSignal, nSpaceWaiters );
+	}
+
+	/*
+		reclaim
+
+		owner가 잡은 채 돌려주지 않은 슬롯들을 reader( const void *data, uint32_t len, uint64_t tag )로
+		읽고 대신 돌려준다. owner가 죽은 뒤에만 불러야 한다.
+	*/
+	template <typename F>
+	void reclaim(uint32_t owner, F reader){
+		for( uint32_t i=0;i<capacity;i++ ){
+			cell_t *c = cell( i );
+			uint64_t seq = c->seq.load( std::memory_order_acquire );
+
+			// 잡힌 슬롯의 seq는 pos + 2 + owner이고 pos & mask == i이다.
+			//   빈 슬롯( pos )과 찬 슬롯( pos + 1 )은 capacity - 2, capacity - 1로 읽힌다.
+			if( ( ( seq - 2 - i ) & mask ) != owner )
+				continue;
+
+			uint64_t pos = seq - 2 - owner;
+			reader( (const void*)( c + 1 ), c->len, c->tag );
+			release( pos );
+		}
+	}
+
+	/*
+		push
+
+		자리가 날 때까지 기다렸다가 넣는다.
+		quit이 0이 아니게 되면 넣지 않고 false를 반환한다.
+	*/
+	template <typename F>
+	bool push(uint32_t len, uint64_t tag, F writer, const std::atomic<uint32_t> *quit){
+		if( len > slotBytes )
+			return false;
+
+		while( true ){
+			uint32_t ticket = spaceSignal.load();
+
+			if( tryPush( len, tag, writer ) )
+				return true;
+			if( quit != nullptr && quit->load() )
+				return false;
+
+			wait( spaceSignal, nSpaceWaiters, ticket, -1,
+				[&](){ return writable(); } );
+		}
+	}
+
+	/*
+		pop
+
+		항목이 들어올 때까지 기다렸다가 읽는다.
+		quit이 0이 아니게 되거나 timeoutMs가 지나면 false를 반환한다.
+	*/
+	template <typename F>
+	bool pop(F reader, const std::atomic<uint32_t> *quit, int timeoutMs = -1){
+		while( true ){
+			uint32_t ticket = itemSignal.load();
+
+			if( tryPop( reader ) )
+				return true;
+			if( quit != nullptr && quit->load() )
+				return false;
+
+			if( !wait( itemSignal, nItemWaiters, ticket, timeoutMs,
+				[&](){ return size() > 0; } ) && timeoutMs >= 0 )
+				return tryPop( reader );
+		}
+	}
+
+	/*
+		claim
+
+		항목이 들어올 때까지 기다렸다가 tryClaim으로 잡는다.
+		quit이 0이 아니게 되면 false를 반환한다.
+	*/
+	bool claim(uint64_t *pos, uint32_t owner, const std::atomic<uint32_t> *quit){
+		while( true ){
+			uint32_t ticket = itemSignal.load();
+
+			if( tryClaim( pos, owner ) )
+				return true;
+			if( quit != nullptr && quit->load() )
+				return false;
+
+			wait( itemSignal, nItemWaiters, ticket, -1,
+				[&](){ return size() > 0; } );
+		}
+	}
+
+	/*
+		wakeAll
+
+		링에서 기다리는 모두를 깨운다. ( 종료 요청 후 사용 )
+	*/
+	void wakeAll(){
+		itemSignal.fetch_add( 1 );
+		spaceSignal.fetch_add( 1 );
+		futexWake( &itemSignal );
+		futexWake( &spaceSignal );
+	}
+
+	/*
+		notify / wait
+
+		eventcount 방식의 잠들기 / 깨우기.
+		기다리는 쪽이 없으면 futex 시스템 콜을 부르지 않는다.
+		링 밖의 공유 메모리 word에도 쓸 수 있다.
+	*/
+	static void notify(std::atomic<uint32_t> &signal, std::atomic<uint32_t> &waiters){
+		signal.fetch_add( 1 );
+		if( waiters.load() > 0 )
+			futexWake( &signal );
+	}
+	template <typename P>
+	static bool wait(std::atomic<uint32_t> &signal, std::atomic<uint32_t> &waiters,
+			 uint32_t ticket, int timeoutMs, P ready){
+		waiters.fetch_add( 1 );
+
+		bool woken = true;
+		if( !ready() && signal.load() == ticket ){
+			futexWait( &signal, ticket, timeoutMs );
+			woken = signal.load() != ticket;
+		}
+
+		waiters.fetch_sub( 1 );
+		return woken;
+	}
+
+protected:
+	struct cell_t{
+		cell_t(uint64_t _seq) :
+			seq( _seq ), len( 0 ), tag( 0 ) {
+		}
+
+		std::atomic<uint64_t> seq;
+		uint32_t len;
+		uint32_t reserved;
+		uint64_t tag;
+		uint64_t padding;	// 데이터를 16바이트 경계에 맞춘다. ( PoolCodec 참고 )
+		// 뒤에 slotSize 바이트의 데이터가 온다.
+	};
+	static_assert( sizeof(cell_t) % 16 == 0, "ShmRing : cell data must be 16-byte aligned" );
+
+	ShmRing() :
+		head( 0 ), tail( 0 ),
+		itemSignal( 0 ), spaceSignal( 0 ),
+		nItemWaiters( 0 ), nSpaceWaiters( 0 ) {
+	}
+
+	static uint32_t roundCapacity(uint32_t capacity){
+		uint32_t n = 4;	// owner 0이 잡은 슬롯을 빈 슬롯, 찬 슬롯과 구분할 수 있는 최소 크기
+		while( n < capacity )
+			n <<= 1;
+		return n;
+	}
+	static size_t cellSize(uint32_t slotSize){
+		return ( sizeof(cell_t) + slotSize + 63 ) & ~(size_t)63;
+	}
+
+	cell_t *cell(uint64_t index){
+		return (cell_t*)( (char*)( this + 1 ) + index * stride );
+	}
+
+	/*
+		writable
+
+		tail의 슬롯이 비어있는지 여부
+		claim으로 잡힌 슬롯은 head가 지나가도 release 전까지 비지 않으므로 size로는 알 수 없다.
+	*/
+	bool writable(){
+		uint64_t pos = tail.load( std::memory_order_relaxed );
+		uint64_t seq = cell( pos & mask )->seq.load( std::memory_order_acquire );
+
+		return (int64_t)seq - (int64_t)pos >= 0;
+	}
+
+protected:
+	alignas(64) std::atomic<uint64_t> head;		// 다음에 읽을 위치
+	alignas(64) std::atomic<uint64_t> tail;		// 다음에 쓸 위치
+
+	alignas(64) std::atomic<uint32_t> itemSignal;	// 항목이 들어올 때마다 증가
+	std::atomic<uint32_t> spaceSignal;		// 자리가 날 때마다 증가
+	std::atomic<uint32_t> nItemWaiters;
+	std::atomic<uint32_t> nSpaceWaiters;
+
+	uint32_t capacity;
+	uint32_t mask;
+	uint32_t slotBytes;
+	uint32_t stride;	// 슬롯 하나의 전체 크기 ( cell_t 헤더 포함 )
+};
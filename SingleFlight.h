@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <exception>
+#include <future>
+#include <mutex>
+
+#include "ShardHash.h"
+
+/*
+	SingleFlight
+
+	같은 키에 대한 계산이 이미 진행 중이면 새 요청을 그 계산에 합류시킨다.
+
+	처음 들어온 요청( leader )만 실제로 계산하고, 계산이 끝나는 동안 들어온
+	요청( follower )들은 complete / fail 에서 같은 결과를 받는다.
+	키의 해시로 shard를 나누어 shard마다 락을 따로 잡는다.
+*/
+template <typename K, typename V, typename Hash = std::hash<K> >
+class SingleFlight{
+public:
+	SingleFlight(int nShard = 16) :
+		shards( nShard > 0 ? nShard : 1 ) {
+	}
+
+	/*
+		join
+
+		key의 계산에 참여한다.
+		진행 중인 계산이 없으면 leader로 등록하고 true를 반환한다.
+		있으면 follower로 합류하여 future에 결과를 받을 future를 넣고 false를 반환한다.
+	*/
+	bool join(const K &key, std::future<V> &future){
+		shard_t &shard = shardOf( key );
+		std::unique_lock<std::mutex> guard( shard.mutex );
+
+		auto it = shard.flights.find( key );
+		if( it == shard.flights.end() ){
+			shard.flights.emplace( key, followers_t() );
+			return true;
+		}
+
+		it->second.emplace_back();
+		future = it->second.back().get_future();
+		return false;
+	}
+
+	/*
+		complete
+
+		key의 계산을 끝내고 follower들에게 결과를 전달한다.
+	*/
+	void complete(const K &key, const V &value){
+		followers_t followers = take( key );
+
+		for( auto &follower : followers )
+			follower.set_value( value );
+	}
+
+	/*
+		fail
+
+		key의 계산을 끝내고 follower들에게 예외를 전달한다.
+	*/
+	void fail(const K &key, std::exception_ptr error){
+		followers_t followers = take( key );
+
+		for( auto &follower : followers )
+			follower.set_exception( error );
+	}
+
+protected:
+	typedef std::vector<std::promise<V> > followers_t;
+
+	struct shard_t{
+		std::mutex mutex;
+		std::unordered_map<K, followers_t, Hash> flights;
+	};
+
+	followers_t take(const K &key){
+		followers_t followers;
+		shard_t &shard = shardOf( key );
+		std::unique_lock<std::mutex> guard( shard.mutex );
+
+		auto it = shard.flights.find( key );
+		if( it != shard.flights.end() ){
+			followers.swap( it->second );
+			shard.flights.erase( it );
+		}
+		return followers;
+	}
+
+	shard_t &shardOf(const K &key){
+		return shards[ shardIndex( Hash()( key ), shards.size() ) ];
+	}
+
+protected:
+	std::vector<shard_t> shards;
+};
@@ -0,0 +1,460 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "PoolCodec.h"
+#include "DynamicProcessPool.h"
+
+/*
+	SocketFrontend
+
+	다른 언어로 작성된 도구들이 Unix 도메인 소켓으로 풀에 workItem을 넣는 입구.
+
+	요청과 응답은 little endian의 길이 접두 프레임이다.
+
+		요청 : [ u32 payload 길이 ][ u64 요청 id ][ payload ]
+		응답 : [ u64 요청 id ][ u32 핸들러의 반환값 ( 0 / 1 ) ]
+
+	payload는 PoolCodec<T>로 decode되어 내부의 DynamicProcessPool에서 처리된다.
+	응답은 처리가 끝난 순서대로 가며 요청 id로 짝을 맞춘다.
+
+	I/O는 쓰레드 하나가 poll로 처리한다.
+	연결마다 한 번에 크게 읽어 그 안의 모든 요청을 모은 뒤 enqueueBulk로 한 번에 넣고,
+	worker가 쌓아둔 응답은 이전에 보내다 남은 부분과 함께 writev 한 번으로 보낸다.
+	응답을 받아가지 않아 보내지 못한 응답이 maxSending을 넘은 연결에서는
+	응답이 빠질 때까지 요청을 더 읽지 않는다.
+
+	T : workItem의 타입 ( PoolCodec<T>와 그 valid가 있어야 한다 )
+*/
+template <typename T>
+class SocketFrontend{
+public:
+	typedef std::function<bool(T)>	handler_t;
+
+	typedef struct{
+		T item;
+		uint64_t connection;	// 요청이 들어온 연결의 id
+		uint64_t id;		// 요청 id
+	} request_t;
+
+	/*
+		SocketFrontend
+
+		_path : 소켓 파일의 경로 ( 이미 있으면 지우고 새로 만든다 )
+		_initialWorkers : 처음에 가지고 시작할 worker의 수
+		_maxWorker : 최대 가질 수 있는 worker의 수
+		_lifeTime : 한 개의 worker가 일을 몇 번 수행할지 횟수
+		_handler : workItem을 핸들링할 핸들러
+		_maxFrame : 요청 payload의 최대 크기 ( 넘으면 연결을 끊는다 )
+	*/
+	SocketFrontend( const std::string &_path,
+			int _initialWorkers, int _maxWorker, int _lifeTime,
+			handler_t _handler, uint32_t _maxFrame = 1 << 20 ) :
+		path( _path ), handler( _handler ), maxFrame( _maxFrame ),
+		nextConnection( 1 ), quit( false ) {
+
+		static_assert( PoolCodec<T>::supported,
+			"SocketFrontend : workItem requires a PoolCodec<T> specialization" );
+		static_assert( PoolCodecCheck<T>::checked,
+			"SocketFrontend : requests come from clients, so PoolCodec<T> must provide valid()" );
+
+		listenSocket = openListener( path );
+
+		wakeEvent = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+		if( wakeEvent < 0 ){
+			int error = errno;
+			close( listenSocket );
+			throw std::system_error( error, std::generic_category(), "SocketFrontend : eventfd" );
+		}
+
+		pool.reset( new pool_t( _initialWorkers, _maxWorker, _lifeTime,
+			[this](request_t request){
+				bool result = handler( std::move( request.item ) );
+				reply( request.connection, request.id, result );
+				return result;
+			}) );
+
+		io = std::thread( &SocketFrontend::iothread, this );
+	}
+	virtual ~SocketFrontend(){
+		kill();
+
+		close( wakeEvent );
+		close( listenSocket );
+		unlink( path.c_str() );
+	}
+
+	SocketFrontend(const SocketFrontend &) = delete;
+	SocketFrontend &operator=(const SocketFrontend &) = delete;
+
+	/*
+		queryPoolStatus
+
+		내부 풀의 상태를 얻어온다.
+
+		waiting : waiting중인 worker의 수를 받아올 포인터
+		working : working중인 worker의 수를 받아올 포인터
+	*/
+	void queryPoolStatus(int *waiting,int *working){
+		pool->queryPoolStatus( waiting, working );
+	}
+
+	/*
+		kill
+
+		연결을 모두 끊고 모든 worker를 죽인다.
+	*/
+	void kill(){
+		if( quit.exchange( true ) )
+			return;
+
+		wake();
+		io.join();
+
+		pool->kill();
+
+		std::unique_lock<std::mutex> guard( connectionMutex );
+		for( auto &connection : connections )
+			close( connection.second->fd );
+		connections.clear();
+	}
+
+protected:
+	typedef DynamicProcessPool<request_t, std::function<bool(request_t)> > pool_t;
+
+	static const size_t readChunk = 64 * 1024;	// 연결에서 한 번에 읽는 크기
+	static const size_t headerSize = sizeof(uint32_t) + sizeof(uint64_t);
+	static const size_t replySize = sizeof(uint64_t) + sizeof(uint32_t);
+	// 보내지 못한 응답이 이만큼 쌓인 연결에서는 응답을 받아갈 때까지 더 읽지 않는다.
+	static const size_t maxSending = 4 * 1024 * 1024;
+
+	struct connection_t{
+		int fd;
+		std::vector<char> input;	// 아직 프레임이 되지 못한 입력
+		std::vector<char> sending;	// 보내다 남은 응답 ( I/O 쓰레드 전용 )
+		std::vector<char> outbox;	// worker가 쌓아둔 응답 ( connectionMutex )
+	};
+
+	/*
+		openListener
+
+		path에 논블로킹 listen 소켓을 연다.
+	*/
+	static int openListener(const std::string &path){
+		struct sockaddr_un addr;
+
+		memset( &addr, 0, sizeof(addr) );
+		addr.sun_family = AF_UNIX;
+		if( path.size() >= sizeof(addr.sun_path) )
+			throw std::invalid_argument( "SocketFrontend : socket path is too long" );
+		memcpy( addr.sun_path, path.c_str(), path.size() );
+
+		int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+		if( fd < 0 )
+			throw std::system_error( errno, std::generic_category(), "SocketFrontend : socket" );
+
+		unlink( path.c_str() );
+		if( bind( fd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 ||
+			listen( fd, SOMAXCONN ) < 0 ){
+			int error = errno;
+			close( fd );
+			throw std::system_error( error, std::generic_category(), "SocketFrontend : bind" );
+		}
+		return fd;
+	}
+
+	void wake(){
+		uint64_t one = 1;
+
+		if( write( wakeEvent, &one, sizeof(one) ) < 0 ){
+			// 이미 신호가 쌓여 있으면 실패해도 된다.
+		}
+	}
+
+	/*
+		reply
+
+		응답을 연결의 outbox에 쌓고 I/O 쓰레드를 깨운다. ( worker 쓰레드 )
+		outbox가 비어있던 경우에만 깨우므로 응답이 몰리면 한 번의 writev로 묶인다.
+	*/
+	void reply(uint64_t connectionId, uint64_t id, bool result){
+		char frame[ replySize ];
+		uint32_t status = result ? 1 : 0;
+		bool first;
+
+		memcpy( frame, &id, sizeof(id) );
+		memcpy( frame + sizeof(id), &status, sizeof(status) );
+
+		{
+			std::unique_lock<std::mutex> guard( connectionMutex );
+
+			auto it = connections.find( connectionId );
+			if( it == connections.end() )
+				return;
+
+			std::vector<char> &outbox = it->second->outbox;
+			first = outbox.empty();
+			outbox.insert( outbox.end(), frame, frame + replySize );
+		}
+
+		if( first )
+			wake();
+	}
+
+	/*
+		iothread
+
+		연결을 받고, 요청을 읽어 풀에 넣고, 응답을 보내는 쓰레드
+	*/
+	void iothread(){
+		std::vector<struct pollfd> fds;
+		std::vector<uint64_t> ids;
+		std::vector<request_t> batch;
+
+		while( !quit.load() ){
+			fds.clear();
+			ids.clear();
+
+			fds.push_back( { wakeEvent, POLLIN, 0 } );
+			fds.push_back( { listenSocket, POLLIN, 0 } );
+			{
+				std::unique_lock<std::mutex> guard( connectionMutex );
+				for( auto &connection : connections ){
+					connection_t *c = connection.second.get();
+					short events = 0;
+
+					// 응답을 받아가지 않는 연결에서 계속 읽으면 응답이 끝없이 쌓인다.
+					if( c->sending.size() + c->outbox.size() < maxSending )
+						events |= POLLIN;
+					if( !c->sending.empty() )
+						events |= POLLOUT;
+
+					fds.push_back( { connection.second->fd, events, 0 } );
+					ids.push_back( connection.first );
+				}
+			}
+
+			if( poll( fds.data(), fds.size(), -1 ) < 0 && errno != EINTR )
+				break;
+
+			if( fds[0].revents & POLLIN ){
+				uint64_t count;
+				if( read( wakeEvent, &count, sizeof(count) ) < 0 ){
+					// 논블로킹이므로 이미 비어있으면 실패한다.
+				}
+			}
+			if( fds[1].revents & POLLIN )
+				acceptConnections();
+
+			for( size_t i=0;i<ids.size();i++ ){
+				if( fds[ i + 2 ].revents & ( POLLIN | POLLHUP | POLLERR ) ){
+					if( !readRequests( ids[i], batch ) )
+						closeConnection( ids[i] );
+				}
+			}
+
+			if( !batch.empty() ){
+				pool->enqueueBulk( std::move(batch) );
+				batch.clear();
+			}
+
+			// 응답은 깨어날 때마다 모든 연결에서 모아 보낸다.
+			for( uint64_t id : ids ){
+				if( !flushReplies( id ) )
+					closeConnection( id );
+			}
+		}
+	}
+
+	/*
+		acceptConnections
+
+		대기 중인 연결을 모두 받는다.
+	*/
+	void acceptConnections(){
+		int fd;
+
+		while( ( fd = accept4( listenSocket, nullptr, nullptr,
+			SOCK_NONBLOCK | SOCK_CLOEXEC ) ) >= 0 ){
+			std::unique_ptr<connection_t> connection( new connection_t() );
+			connection->fd = fd;
+
+			std::unique_lock<std::mutex> guard( connectionMutex );
+			connections[ nextConnection ++ ] = std::move( connection );
+		}
+	}
+
+	/*
+		readRequests
+
+		연결에서 읽을 수 있는 만큼 읽어 완성된 요청들을 batch에 더한다.
+		연결이 닫혔거나 프레임이 잘못되었으면 false를 반환한다.
+	*/
+	bool readRequests(uint64_t connectionId, std::vector<request_t> &batch){
+		connection_t *connection = find( connectionId );
+		if( connection == nullptr )
+			return true;
+
+		std::vector<char> &input = connection->input;
+		bool open = true;
+
+		// 한 번에 너무 오래 붙잡지 않도록 readChunk의 몇 배까지만 읽는다.
+		for( int round=0;round<4;round++ ){
+			size_t used = input.size();
+			input.resize( used + readChunk );
+
+			ssize_t n = read( connection->fd, input.data() + used, readChunk );
+			input.resize( used + ( n > 0 ? (size_t)n : 0 ) );
+
+			if( n == 0 ){
+				open = false;
+				break;
+			}
+			if( n < 0 ){
+				if( errno == EINTR )
+					continue;
+				if( errno != EAGAIN && errno != EWOULDBLOCK )
+					open = false;
+				break;
+			}
+			if( (size_t)n < readChunk )
+				break;
+		}
+
+		size_t offset = 0;
+		while( input.size() - offset >= headerSize ){
+			uint32_t len;
+			uint64_t id;
+
+			memcpy( &len, input.data() + offset, sizeof(len) );
+			memcpy( &id, input.data() + offset + sizeof(len), sizeof(id) );
+
+			if( len > maxFrame )
+				return false;
+			if( input.size() - offset < headerSize + len )
+				break;
+
+			// 올바른 인코딩이 아닌 프레임을 보낸 연결은 닫는다.
+			request_t request;
+			if( !PoolCodecCheck<T>::tryDecode( input.data() + offset + headerSize, len, &request.item ) )
+				return false;
+			request.connection = connectionId;
+			request.id = id;
+			batch.push_back( std::move(request) );
+
+			offset += headerSize + len;
+		}
+		input.erase( input.begin(), input.begin() + offset );
+
+		return open;
+	}
+
+	/*
+		flushReplies
+
+		outbox의 응답을 보내다 남은 응답 뒤에 붙여 writev 한 번으로 보낸다.
+		연결에 문제가 있으면 false를 반환한다.
+	*/
+	bool flushReplies(uint64_t connectionId){
+		std::vector<char> batch;
+		connection_t *connection;
+		{
+			std::unique_lock<std::mutex> guard( connectionMutex );
+
+			auto it = connections.find( connectionId );
+			if( it == connections.end() )
+				return true;
+
+			connection = it->second.get();
+			batch.swap( connection->outbox );
+		}
+
+		std::vector<char> &sending = connection->sending;
+		if( sending.empty() && batch.empty() )
+			return true;
+
+		struct iovec iov[2] = {
+			{ sending.data(), sending.size() },
+			{ batch.data(), batch.size() },
+		};
+
+		ssize_t n;
+		while( ( n = writev( connection->fd, iov, 2 ) ) < 0 && errno == EINTR );
+		if( n < 0 ){
+			if( errno != EAGAIN && errno != EWOULDBLOCK )
+				return false;
+			n = 0;
+		}
+
+		// 보내지 못한 부분은 sending에 남겨두고 POLLOUT을 기다린다.
+		size_t written = (size_t)n;
+		if( written >= sending.size() ){
+			written -= sending.size();
+			sending.assign( batch.begin() + written, batch.end() );
+		}
+		else{
+			sending.erase( sending.begin(), sending.begin() + written );
+			sending.insert( sending.end(), batch.begin(), batch.end() );
+		}
+		return true;
+	}
+
+	connection_t *find(uint64_t connectionId){
+		std::unique_lock<std::mutex> guard( connectionMutex );
+
+		auto it = connections.find( connectionId );
+		return it == connections.end() ? nullptr : it->second.get();
+	}
+
+	void closeConnection(uint64_t connectionId){
+		std::unique_lock<std::mutex> guard( connectionMutex );
+
+		auto it = connections.find( connectionId );
+		if( it == connections.end() )
+			return;
+
+		close( it->second->fd );
+		connections.erase( it );
+	}
+
+protected:
+	std::string path;	// 소켓 파일의 경로
+	handler_t handler;
+	uint32_t maxFrame;
+
+	int listenSocket;
+	int wakeEvent;		// worker가 응답을 쌓았을 때 I/O 쓰레드를 깨우는 eventfd
+
+	// 연결 목록
+	//   연결을 지우는 것은 I/O 쓰레드뿐이므로 I/O 쓰레드는 락 밖에서 connection_t를 쓸 수 있다.
+	std::unordered_map<uint64_t, std::unique_ptr<connection_t> > connections;
+	std::mutex connectionMutex;
+	uint64_t nextConnection;
+
+	std::unique_ptr<pool_t> pool;	// 실제로 workItem을 처리하는 풀
+	std::thread io;			// I/O 쓰레드
+	std::atomic<bool> quit;
+};
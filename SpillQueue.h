@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+
+#include <string>
+#include <deque>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "PoolCodec.h"
+
+/*
+	SpillQueue
+
+	메모리에 담기 어려운 backlog를 memory-mapped segment 파일에 쌓아두는 FIFO 큐.
+	workItem은 PoolCodec<T>로 직렬화되어 segment 끝에 덧붙여지고,
+	앞에서부터 순서대로 읽혀 나간다.
+
+	다 쓴 segment는 매핑에서 페이지를 내려놓고( MADV_DONTNEED ),
+	다 읽은 segment는 매핑을 풀고 파일을 지우므로
+	상주 메모리는 대략 segment 두 개 정도로 유지된다.
+
+	쓰레드 안전하지 않다. 호출하는 쪽의 락으로 보호해야 한다.
+*/
+class SpillQueue{
+public:
+	/*
+		SpillQueue
+
+		_directory : segment 파일을 만들 디렉토리
+		_segmentSize : segment 하나의 크기
+	*/
+	SpillQueue(const std::string &_directory, size_t _segmentSize = 64 * 1024 * 1024) :
+		directory( _directory ), segmentSize( _segmentSize ),
+		nSegment( 0 ), count( 0 ), totalBytes( 0 ) {
+	}
+	~SpillQueue(){
+		while( !segments.empty() ){
+			closeSegment( segments.front() );
+			segments.pop_front();
+		}
+	}
+
+	SpillQueue(const SpillQueue &) = delete;
+	SpillQueue &operator=(const SpillQueue &) = delete;
+
+	/*
+		push
+
+		workItem을 직렬화하여 큐의 끝에 붙인다.
+
+		item : 넣을 workItem
+		tag : workItem과 함께 보관할 값 ( 저널 id 등 )
+	*/
+	template <typename T>
+	void push(const T &item, uint64_t tag = 0){
+		size_t len = PoolCodec<T>::encodedSize( item );
+
+		PoolCodec<T>::encode( item, append( len, tag ) );
+
+		count ++;
+		totalBytes += len;
+	}
+
+	/*
+		pop
+
+		큐의 맨 앞 workItem을 꺼낸다.
+		큐가 비어있으면 false를 반환한다.
+
+		item : 꺼낸 workItem을 받을 변수
+		tag : push할 때 함께 넣은 값을 받을 포인터 ( nullptr 가능 )
+	*/
+	template <typename T>
+	bool pop(T &item, uint64_t *tag = nullptr){
+		const void *payload;
+		size_t len;
+
+		if( !front( &payload, &len, tag ) )
+			return false;
+
+		item = PoolCodec<T>::decode( payload, len );
+		consume( len );
+
+		return true;
+	}
+
+	bool empty() const{
+		return count == 0;
+	}
+	size_t size() const{
+		return count;
+	}
+	/*
+		bytes
+
+		큐에 쌓인 직렬화된 payload의 바이트 합
+	*/
+	size_t bytes() const{
+		return totalBytes;
+	}
+
+protected:
+	struct segment_t{
+		std::string path;
+		int fd;
+		char *base;
+		size_t capacity;
+		size_t writePos;
+		size_t readPos;
+	};
+
+	// 레코드 : [ len u64 ][ tag u64 ][ payload ( 8바이트 정렬 ) ]
+	static const size_t headerSize = sizeof(uint64_t) * 2;
+
+	static size_t recordSize(size_t len){
+		return headerSize + ( ( len + 7 ) & ~(size_t)7 );
+	}
+
+	/*
+		append
+
+		len 바이트짜리 레코드 자리를 만들고 payload 위치를 반환한다.
+	*/
+	void *append(size_t len, uint64_t tag){
+		size_t rec = recordSize( len );
+
+		if( segments.empty() ||
+			segments.back().capacity - segments.back().writePos < rec ){
+
+			if( !segments.empty() )
+				sealSegment( segments.back() );
+			segments.push_back( openSegment( rec ) );
+		}
+
+		segment_t &seg = segments.back();
+		char *p = seg.base + seg.writePos;
+
+		((uint64_t*)p)[0] = len;
+		((uint64_t*)p)[1] = tag;
+		seg.writePos += rec;
+
+		return p + headerSize;
+	}
+
+	bool front(const void **payload, size_t *len, uint64_t *tag){
+		while( !segments.empty() ){
+			segment_t &seg = segments.front();
+
+			if( seg.readPos < seg.writePos ){
+				char *p = seg.base + seg.readPos;
+
+				*len = ((uint64_t*)p)[0];
+				if( tag != nullptr )
+					*tag = ((uint64_t*)p)[1];
+				*payload = p + headerSize;
+				return true;
+			}
+
+			// 쓰는 중인 segment는 남겨둔다.
+			if( segments.size() == 1 )
+				return false;
+
+			closeSegment( seg );
+			segments.pop_front();
+		}
+		return false;
+	}
+
+	void consume(size_t len){
+		segments.front().readPos += recordSize( len );
+
+		count --;
+		totalBytes -= len;
+	}
+
+	segment_t openSegment(size_t minSize){
+		segment_t seg;
+		size_t page = (size_t)sysconf( _SC_PAGESIZE );
+		size_t size = minSize > segmentSize ? minSize : segmentSize;
+
+		seg.capacity = ( size + page - 1 ) / page * page;
+		seg.path = directory + "/spill-" + std::to_string( getpid() ) + "-" +
+			std::to_string( (uintptr_t)this ) + "-" + std::to_string( nSegment++ ) + ".seg";
+		seg.writePos = seg.readPos = 0;
+
+		seg.fd = open( seg.path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600 );
+		if( seg.fd < 0 )
+			throw std::system_error( errno, std::generic_category(), "SpillQueue : open" );
+
+		// 디스크 블록을 미리 잡아둔다. sparse 파일이면 디스크가 찼을 때
+		//   매핑에 쓰는 순간 SIGBUS로 죽으므로, 여기서 예외로 실패시킨다.
+		int err = posix_fallocate( seg.fd, 0, (off_t)seg.capacity );
+		if( err != 0 ){
+			close( seg.fd );
+			unlink( seg.path.c_str() );
+			throw std::system_error( err, std::generic_category(), "SpillQueue : posix_fallocate" );
+		}
+
+		void *base = mmap( nullptr, seg.capacity, PROT_READ | PROT_WRITE, MAP_SHARED, seg.fd, 0 );
+		if( base == MAP_FAILED ){
+			err = errno;
+			close( seg.fd );
+			unlink( seg.path.c_str() );
+			throw std::system_error( err, std::generic_category(), "SpillQueue : mmap" );
+		}
+		seg.base = (char*)base;
+
+		return seg;
+	}
+
+	/*
+		sealSegment
+
+		더 이상 쓰지 않을 segment의 write-back을 시작하고
+		아직 읽히지 않은 페이지를 상주 메모리에서 내려놓는다.
+	*/
+	void sealSegment(segment_t &seg){
+		size_t page = (size_t)sysconf( _SC_PAGESIZE );
+		size_t from = seg.readPos / page * page;
+
+		msync( seg.base, seg.writePos, MS_ASYNC );
+		if( from < seg.capacity )
+			madvise( seg.base + from, seg.capacity - from, MADV_DONTNEED );
+	}
+
+	void closeSegment(segment_t &seg){
+		munmap( seg.base, seg.capacity );
+		close( seg.fd );
+		unlink( seg.path.c_str() );
+	}
+
+protected:
+	std::string directory;
+	size_t segmentSize;
+	size_t nSegment;	// 지금까지 만든 segment의 수 ( 파일 이름용 )
+
+	std::deque<segment_t> segments;
+
+	size_t count;		// 쌓인 workItem의 수
+	size_t totalBytes;	// 쌓인 payload의 바이트 합
+};
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+
+#include <functional>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <system_error>
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include <unistd.h>
+
+class StreamSource;
+
+/*
+	StreamBuffer
+
+	StreamSource가 돌려쓰는 큰 읽기 버퍼 하나.
+	refs는 이 버퍼를 가리키는 BufferSlice의 수 ( 읽는 중이면 +1 ) 이며,
+	0이 되면 버퍼는 StreamSource의 빈 버퍼 목록으로 돌아간다.
+*/
+struct StreamBuffer{
+	std::vector<char> bytes;
+	std::atomic<int> refs;
+	StreamSource *owner;
+};
+
+/*
+	BufferSlice
+
+	StreamBuffer 안의 레코드 하나를 가리키는 non-owning 조각.
+	복사하면 버퍼의 참조가 늘고, 소멸하면 줄어든다. ( move는 참조를 옮긴다. )
+	풀은 핸들러가 끝난 뒤 workItem을 소멸시키므로 버퍼는 그때 돌아간다.
+*/
+class BufferSlice{
+public:
+	BufferSlice() :
+		buffer( nullptr ), data( nullptr ), len( 0 ) {
+	}
+	BufferSlice(StreamBuffer *_buffer, const char *_data, size_t _len) :
+		buffer( _buffer ), data( _data ), len( _len ) {
+		buffer->refs.fetch_add( 1, std::memory_order_relaxed );
+	}
+	BufferSlice(const BufferSlice &other) :
+		buffer( other.buffer ), data( other.data ), len( other.len ) {
+		if( buffer != nullptr )
+			buffer->refs.fetch_add( 1, std::memory_order_relaxed );
+	}
+	BufferSlice(BufferSlice &&other) noexcept :
+		buffer( other.buffer ), data( other.data ), len( other.len ) {
+		other.buffer = nullptr;
+	}
+	~BufferSlice(){
+		release();
+	}
+
+	BufferSlice &operator=(BufferSlice other) noexcept{
+		std::swap( buffer, other.buffer );
+		std::swap( data, other.data );
+		std::swap( len, other.len );
+		return *this;
+	}
+
+	std::string_view view() const{
+		return std::string_view( data, len );
+	}
+	const char *begin() const{
+		return data;
+	}
+	size_t size() const{
+		return len;
+	}
+
+protected:
+	inline void release();
+
+protected:
+	StreamBuffer *buffer;	// 가리키는 버퍼 ( 없으면 nullptr )
+	const char *data;
+	size_t len;
+};
+
+/*
+	StreamSource
+
+	stdin, 파이프, 소켓 같은 fd에서 읽어 레코드를 BufferSlice로 풀에 넣는 입력 단계.
+
+	nBuffers개의 큰 버퍼를 돌려쓰며, 레코드마다 할당하거나 복사하지 않고
+	버퍼 안의 위치만 가리키는 BufferSlice를 만든다.
+	버퍼 끝에 걸친 마지막 레코드의 앞부분만 다음 버퍼의 처음으로 복사한다.
+	모든 버퍼가 핸들러에게 참조되고 있으면 하나가 돌아올 때까지 읽기를 멈춘다.
+
+	레코드 경계는 구분자( 기본 '\n', 레코드에 포함되지 않음 )
+	또는 framing 함수( MappedFileSource와 같은 형태 )로 정한다.
+	버퍼보다 긴 레코드를 만나면 그 버퍼를 레코드가 들어갈 만큼 키운다.
+
+	풀은 StreamSource보다 먼저 모든 workItem을 처리하거나 소멸해야 한다.
+	( 소멸자는 모든 버퍼가 돌아올 때까지 기다린다. )
+
+		StreamSource source( STDIN_FILENO );
+		DynamicProcessPool<BufferSlice> pool( n, n, lifeTime,
+			[](BufferSlice record){ ... record.view() ...; return true; } );
+		source.pump( pool );
+*/
+class StreamSource{
+public:
+	// begin에서 시작하는 레코드의 길이를 반환한다. ( end를 넘거나 잘못되었으면 0 )
+	typedef std::function<size_t(const char *begin, const char *end)> framer_t;
+
+	/*
+		StreamSource
+
+		_fd : 읽을 fd ( 닫지 않는다 )
+		bufferSize : 버퍼 하나의 크기
+		nBuffers : 돌려쓸 버퍼의 수
+	*/
+	StreamSource(int _fd, size_t bufferSize = 1 << 20, int nBuffers = 8) :
+		fd( _fd ), delimiter( '\n' ) {
+
+		for(int i=0;i<( nBuffers > 1 ? nBuffers : 2 );i++){
+			std::unique_ptr<StreamBuffer> buffer( new StreamBuffer() );
+
+			buffer->bytes.resize( bufferSize > 0 ? bufferSize : 4096 );
+			buffer->refs.store( 0 );
+			buffer->owner = this;
+
+			freeBuffers.push_back( buffer.get() );
+			buffers.push_back( std::move(buffer) );
+		}
+	}
+	virtual ~StreamSource(){
+		std::unique_lock<std::mutex> guard( bufferMutex );
+
+		bufferSignal.wait( guard, [this](){
+			return freeBuffers.size() == buffers.size();
+		});
+	}
+
+	StreamSource(const StreamSource &) = delete;
+	StreamSource &operator=(const StreamSource &) = delete;
+
+	/*
+		setDelimiter
+
+		레코드를 구분자로 나눈다. pump 전에 호출해야 한다.
+	*/
+	void setDelimiter(char _delimiter){
+		delimiter = _delimiter;
+		framer = framer_t();
+	}
+	/*
+		setFraming
+
+		레코드를 framing 함수로 나눈다. pump 전에 호출해야 한다.
+	*/
+	void setFraming(framer_t _framer){
+		framer = _framer;
+	}
+
+	/*
+		pump
+
+		fd가 EOF가 될 때까지 읽어 레코드들을 풀에 넣는다. ( 호출한 쓰레드에서 읽는다. )
+		한 번의 read로 완성된 레코드들은 enqueueBulk로 한 번에 넣는다.
+		framing 방식에서 EOF에 남은 불완전한 레코드는 버린다.
+
+		반환값 : 넣은 레코드의 수
+	*/
+	template <typename P>
+	size_t pump(P &pool){
+		StreamBuffer *current = acquire();
+		size_t filled = 0;	// 버퍼에 읽은 바이트
+		size_t parsed = 0;	// 레코드로 내보낸 바이트
+		size_t count = 0;
+
+		while( true ){
+			if( filled == current->bytes.size() ){
+				size_t tail = filled - parsed;
+
+				if( parsed == 0 ){
+					// 버퍼 하나보다 긴 레코드 ( 이 버퍼를 가리키는 slice가 없으므로 키워도 된다. )
+					current->bytes.resize( current->bytes.size() * 2 );
+				}
+				else{
+					StreamBuffer *next = acquire();
+					if( next->bytes.size() < tail )
+						next->bytes.resize( tail );
+
+					memcpy( next->bytes.data(), current->bytes.data() + parsed, tail );
+					release( current );
+
+					current = next;
+					filled = tail;
+					parsed = 0;
+				}
+			}
+
+			ssize_t n = read( fd, current->bytes.data() + filled, current->bytes.size() - filled );
+			if( n < 0 ){
+				if( errno == EINTR )
+					continue;
+
+				int error = errno;
+				release( current );
+				throw std::system_error( error, std::generic_category(), "StreamSource : read" );
+			}
+
+			std::vector<BufferSlice> batch;
+			bool eof = n == 0;
+
+			filled += (size_t)n;
+			parsed = frame( current, parsed, filled, eof, batch );
+
+			count += batch.size();
+			if( !batch.empty() )
+				pool.enqueueBulk( std::move(batch) );
+
+			if( eof )
+				break;
+		}
+
+		release( current );
+		return count;
+	}
+
+protected:
+	friend class BufferSlice;
+
+	/*
+		frame
+
+		buffer의 [ begin, end )에서 완성된 레코드들을 batch에 더한다.
+		eof이면 구분자 없이 끝난 마지막 레코드도 내보낸다.
+
+		반환값 : 내보낸 바이트의 끝
+	*/
+	size_t frame(StreamBuffer *buffer, size_t begin, size_t end, bool eof,
+		     std::vector<BufferSlice> &batch){
+		const char *base = buffer->bytes.data();
+		const char *p = base + begin;
+		const char *last = base + end;
+
+		if( framer ){
+			while( p < last ){
+				size_t len = framer( p, last );
+				if( len == 0 || len > (size_t)( last - p ) )
+					break;
+
+				batch.emplace_back( buffer, p, len );
+				p += len;
+			}
+			return (size_t)( p - base );
+		}
+
+		while( p < last ){
+			const char *found = (const char*)memchr( p, delimiter, last - p );
+			if( found == nullptr ){
+				if( eof ){
+					batch.emplace_back( buffer, p, last - p );
+					p = last;
+				}
+				break;
+			}
+
+			batch.emplace_back( buffer, p, found - p );
+			p = found + 1;
+		}
+		return (size_t)( p - base );
+	}
+
+	/*
+		acquire
+
+		빈 버퍼를 하나 가져온다. 없으면 돌아올 때까지 기다린다.
+	*/
+	StreamBuffer *acquire(){
+		std::unique_lock<std::mutex> guard( bufferMutex );
+
+		bufferSignal.wait( guard, [this](){
+			return !freeBuffers.empty();
+		});
+
+		StreamBuffer *buffer = freeBuffers.back();
+		freeBuffers.pop_back();
+
+		buffer->refs.store( 1 );	// 읽는 쪽의 참조
+		return buffer;
+	}
+
+	/*
+		release
+
+		버퍼의 참조를 하나 줄이고, 마지막 참조였으면 빈 버퍼 목록으로 돌려놓는다.
+	*/
+	static void release(StreamBuffer *buffer){
+		if( buffer->refs.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+			return;
+
+		StreamSource *owner = buffer->owner;
+		std::unique_lock<std::mutex> guard( owner->bufferMutex );
+
+		owner->freeBuffers.push_back( buffer );
+		owner->bufferSignal.notify_all();
+	}
+
+protected:
+	int fd;
+
+	char delimiter;
+	framer_t framer;	// 없으면 delimiter로 나눈다.
+
+	std::vector<std::unique_ptr<StreamBuffer> > buffers;
+	std::vector<StreamBuffer*> freeBuffers;	// 참조가 없는 버퍼들
+	std::mutex bufferMutex;
+	std::condition_variable bufferSignal;
+};
+
+inline void BufferSlice::release(){
+	if( buffer != nullptr )
+		StreamSource::release( buffer );
+	buffer = nullptr;
+}
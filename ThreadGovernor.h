@@ -0,0 +1,364 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "CgroupCpu.h"
+
+/*
+	ThreadGovernor
+
+	한 프로세스 안의 여러 풀이 함께 쓰는 active worker 예산.
+	풀마다 maxWorker를 따로 잡으면 부하가 몰릴 때 그 합이 코어 수를 몇 배나 넘으므로,
+	풀들을 governor에 등록하고 workItem을 처리하는( idle이 아닌 ) worker의 합을 budget 이하로 맞춘다.
+
+	각 풀은 가중치에 비례한 몫( share = budget * weight / 가중치 합, 최소 1 )을 보장받는다.
+	다른 풀이 쓰지 않는 자리는 몫을 넘어서도 빌려 쓸 수 있지만, 몫보다 적게 쓰는 풀이
+	자리를 얻지 못해 기다리면 빌려 쓰던 풀의 worker가 workItem 사이에서 자리를 돌려준다.
+
+	worker는 idle에서 일을 시작할 때 acquire로 자리를 얻고, 큐가 비어 쉬게 되면 release한다.
+	연달아 처리하는 동안에는 governor를 거치지 않는다.
+	blocking 동안 돌려준 자리는 돌아올 때 reclaim으로 다른 worker보다 먼저 다시 얻는다.
+	blocking에서 잡은 락을 쥔 채 돌아올 수 있으므로 reclaim은 reclaimTimeout까지만 기다리고,
+	그 안에 자리가 나지 않으면 예산을 넘어 자리를 얻는다. ( 다음 workItem 사이에 돌려준다. )
+
+		ThreadGovernor &governor = ThreadGovernor::shared();
+		poolA.setGovernor( governor, 2.0 );
+		poolB.setGovernor( governor, 1.0 );
+*/
+class ThreadGovernor{
+public:
+	// 자리가 났을 때 기다리는 풀의 worker를 깨우는 함수 ( 락을 잡지 않아야 한다. )
+	typedef std::function<void()> wake_t;
+
+	/*
+		ThreadGovernor
+
+		_budget : active worker 수의 상한 ( 0이면 availableCpus()를 따라간다. )
+	*/
+	ThreadGovernor(int _budget = 0) :
+		fixedBudget( std::max( _budget, 0 ) ), reclaimTimeoutMs( 20 ),
+		nActive( 0 ), nStarving( 0 ), nReclaiming( 0 ) {
+	}
+
+	ThreadGovernor(const ThreadGovernor &) = delete;
+	ThreadGovernor &operator=(const ThreadGovernor &) = delete;
+
+	/*
+		shared
+
+		프로세스 전체에서 쓰는 governor ( budget은 availableCpus() )
+		풀들보다 오래 살아야 하므로 해제하지 않는다.
+	*/
+	static ThreadGovernor &shared(){
+		static ThreadGovernor *governor = new ThreadGovernor();
+		return *governor;
+	}
+
+	/*
+		setBudget
+
+		_budget : active worker 수의 상한 ( 0이면 availableCpus()를 따라간다. )
+	*/
+	void setBudget(int _budget){
+		fixedBudget.store( std::max( _budget, 0 ) );
+		reclaimSignal.notify_all();
+		wakeStarving();
+	}
+	int budget(){
+		int value = fixedBudget.load();
+		return value > 0 ? value : availableCpus();
+	}
+
+	/*
+		setReclaimTimeout
+
+		reclaim이 자리를 기다리는 최대 시간. 지나면 예산을 넘어 자리를 얻는다.
+		( 기본값 20ms )
+	*/
+	void setReclaimTimeout(std::chrono::milliseconds timeout){
+		reclaimTimeoutMs.store( (int)std::max( timeout.count(), (decltype(timeout.count()))0 ) );
+		reclaimSignal.notify_all();
+	}
+
+	/*
+		registerPool
+
+		weight : 가중치 ( 0보다 커야 한다. )
+		wake : 자리가 났을 때 그 풀의 기다리는 worker를 깨우는 함수
+		반환값 : 풀의 id
+	*/
+	int registerPool(double weight, wake_t wake){
+		std::unique_lock<std::mutex> guard( governorMutex );
+
+		pool_t entry;
+		entry.weight = weight > 0 ? weight : 1.0;
+		entry.active = 0;
+		entry.starving = false;
+		entry.registered = true;
+		entry.wake = wake;
+
+		for( size_t i=0;i<pools.size();i++ ){
+			if( !pools[i].registered ){
+				pools[i] = entry;
+				return (int)i;
+			}
+		}
+
+		pools.push_back( entry );
+		return (int)pools.size() - 1;
+	}
+	/*
+		unregisterPool
+
+		풀의 등록을 지운다. 그 풀의 worker가 모두 자리를 돌려준 뒤에 불러야 한다.
+	*/
+	void unregisterPool(int id){
+		{
+			std::unique_lock<std::mutex> guard( governorMutex );
+
+			pool_t &entry = pools[id];
+			nActive.fetch_sub( entry.active );
+			setStarving( entry, false );
+
+			entry.registered = false;
+			entry.active = 0;
+			entry.wake = wake_t();
+		}
+		reclaimSignal.notify_all();
+		wakeStarving();
+	}
+
+	/*
+		acquire
+
+		풀 id의 worker 하나가 쓸 자리를 얻는다.
+		reclaim으로 기다리는 worker들의 자리를 빼면 남는 자리가 없거나, 몫을 넘는데
+		몫보다 적게 쓰는 다른 풀이 기다리고 있으면 false를 반환하고 자리가 날 때 wake로 깨운다.
+	*/
+	bool acquire(int id){
+		std::unique_lock<std::mutex> guard( governorMutex );
+
+		pool_t &entry = pools[id];
+		int limit = budget();
+		bool underShare = entry.active < shareOf( entry, limit );
+
+		if( nActive.load() + nReclaiming.load() >= limit ||
+			( !underShare && otherStarving( id, limit ) ) ){
+			setStarving( entry, true );
+			return false;
+		}
+
+		setStarving( entry, false );
+		entry.active ++;
+		nActive.fetch_add( 1 );
+		return true;
+	}
+	/*
+		reclaim
+
+		blocking에서 돌아온 풀 id의 worker가 하던 workItem을 마저 끝낼 자리를 얻는다.
+		자리가 날 때까지 기다린다. 기다리는 동안 acquire는 그만큼의 자리를 남겨두고,
+		자리를 가진 worker들은 shouldYield로 workItem 사이에서 자리를 돌려준다.
+
+		worker는 blocking에서 잡은 락을 쥐고 있을 수 있고, 자리를 가진 worker들이 그 락을
+		기다리면 자리는 나지 않는다. 그래서 reclaimTimeout이 지나면 예산을 넘어 자리를 얻고,
+		넘은 자리는 shouldYield로 다음 workItem 사이에 돌려받는다.
+	*/
+	void reclaim(int id){
+		std::unique_lock<std::mutex> guard( governorMutex );
+		auto deadline = std::chrono::steady_clock::now() +
+			std::chrono::milliseconds( reclaimTimeoutMs.load() );
+
+		nReclaiming.fetch_add( 1 );
+
+		// budget()은 cgroup을 따라 바뀔 수 있으므로 시간 제한을 두고 다시 확인한다.
+		while( nActive.load() >= budget() ){
+			auto now = std::chrono::steady_clock::now();
+			if( now >= deadline )
+				break;
+
+			reclaimSignal.wait_for( guard,
+				std::min<std::chrono::steady_clock::duration>( deadline - now,
+					std::chrono::milliseconds( 10 ) ) );
+		}
+
+		nReclaiming.fetch_sub( 1 );
+
+		pools[id].active ++;
+		nActive.fetch_add( 1 );
+	}
+
+	/*
+		release
+
+		풀 id의 worker 하나가 자리를 돌려준다.
+	*/
+	void release(int id){
+		{
+			std::unique_lock<std::mutex> guard( governorMutex );
+
+			pools[id].active --;
+			nActive.fetch_sub( 1 );
+		}
+		reclaimSignal.notify_one();
+		wakeStarving();
+	}
+
+	/*
+		withdraw
+
+		풀 id에 더 기다리는 workItem이 없음을 알린다. ( 큐가 비었을 때 )
+	*/
+	void withdraw(int id){
+		if( nStarving.load() == 0 )
+			return;
+
+		std::unique_lock<std::mutex> guard( governorMutex );
+		setStarving( pools[id], false );
+	}
+
+	/*
+		shouldYield
+
+		자리를 가진 worker가 workItem 사이에서 자리를 돌려줘야 하는지 여부
+		몫과 관계없이 예산을 넘었거나, reclaim으로 기다리는 worker들의 자리가 모자라면 true.
+		몫을 넘게 빌려 쓰는데 몫보다 적게 쓰는 풀이 기다려도 true.
+	*/
+	bool shouldYield(int id){
+		int limit = budget();
+		int active = nActive.load();
+
+		// 기다리는 쪽이 없고 예산 안이면 락 없이 넘어간다.
+		if( nStarving.load() == 0 && nReclaiming.load() == 0 && active <= limit )
+			return false;
+
+		if( active + nReclaiming.load() > limit )
+			return true;
+
+		std::unique_lock<std::mutex> guard( governorMutex );
+
+		pool_t &entry = pools[id];
+		return entry.active > shareOf( entry, limit ) && otherStarving( id, limit );
+	}
+
+	/*
+		queryGovernor
+
+		active : 자리를 가진 worker 수를 받아올 포인터
+		_budget : 지금의 예산을 받아올 포인터
+	*/
+	void queryGovernor(int *active,int *_budget){
+		if( active != nullptr )
+			*active = nActive.load();
+		if( _budget != nullptr )
+			*_budget = budget();
+	}
+	/*
+		queryPool
+
+		active : 풀 id의 자리를 가진 worker 수를 받아올 포인터
+		share : 풀 id가 보장받는 몫을 받아올 포인터
+	*/
+	void queryPool(int id,int *active,int *share){
+		std::unique_lock<std::mutex> guard( governorMutex );
+
+		if( active != nullptr )
+			*active = pools[id].active;
+		if( share != nullptr )
+			*share = shareOf( pools[id], budget() );
+	}
+
+protected:
+	struct pool_t{
+		double weight;
+		int active;		// 자리를 가진 worker 수
+		bool starving;		// 자리를 얻지 못해 기다리는 worker가 있는지
+		bool registered;
+		wake_t wake;
+	};
+
+	/*
+		shareOf
+
+		가중치에 비례한 몫 ( 최소 1, governorMutex를 잡고 불러야 한다. )
+	*/
+	int shareOf(const pool_t &entry, int limit){
+		double total = 0;
+		for( auto &pool : pools ){
+			if( pool.registered )
+				total += pool.weight;
+		}
+
+		int share = total > 0 ? (int)( limit * entry.weight / total ) : limit;
+		return std::max( share, 1 );
+	}
+
+	/*
+		otherStarving
+
+		몫보다 적게 쓰면서 기다리는 다른 풀이 있는지 ( governorMutex를 잡고 불러야 한다. )
+	*/
+	bool otherStarving(int id, int limit){
+		for( size_t i=0;i<pools.size();i++ ){
+			const pool_t &pool = pools[i];
+
+			if( (int)i != id && pool.registered && pool.starving &&
+				pool.active < shareOf( pool, limit ) )
+				return true;
+		}
+		return false;
+	}
+
+	void setStarving(pool_t &entry, bool starving){
+		if( entry.starving == starving )
+			return;
+
+		entry.starving = starving;
+		nStarving.fetch_add( starving ? 1 : -1 );
+	}
+
+	/*
+		wakeStarving
+
+		기다리는 풀들을 깨운다. 몫보다 적게 쓰는 풀을 먼저 깨운다.
+		unregisterPool과 엇갈려 사라진 풀을 깨우지 않도록 governorMutex를 잡은 채로 부른다.
+	*/
+	void wakeStarving(){
+		if( nStarving.load() == 0 )
+			return;
+
+		std::unique_lock<std::mutex> guard( governorMutex );
+		int limit = budget();
+
+		for( int pass=0;pass<2;pass++ ){
+			for( auto &pool : pools ){
+				if( !pool.registered || !pool.starving || !pool.wake )
+					continue;
+				if( ( pool.active < shareOf( pool, limit ) ) == ( pass == 0 ) )
+					pool.wake();
+			}
+		}
+	}
+
+protected:
+	std::atomic<int> fixedBudget;	// 0이면 availableCpus()
+	std::atomic<int> reclaimTimeoutMs;	// reclaim이 기다리는 최대 시간
+
+	std::vector<pool_t> pools;	// id로 찾는 등록된 풀들
+	std::mutex governorMutex;
+
+	std::atomic<int> nActive;	// 자리를 가진 worker 수의 합
+	std::atomic<int> nStarving;	// 기다리는 풀의 수
+	std::atomic<int> nReclaiming;	// reclaim으로 자리를 기다리는 worker 수
+	std::condition_variable reclaimSignal;	// reclaim을 깨우는 시그날
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <variant>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+#include "DynamicProcessPool.h"
+
+/*
+	VariantDispatcher
+
+	std::variant<A, B, C> workItem을 alternative별 핸들러로 분기시키는 함수 객체.
+	분기는 컴파일 타임에 생성된 jump table( 함수 포인터 배열 )을 통해
+	variant::index()로 한 번에 이루어진다.
+
+	핸들러들은 타입 그대로 tuple에 보관되므로 std::function을 거치지 않고,
+	각 jump table 엔트리 안에서 인라인된다.
+
+	Handlers : alternative 순서대로 나열된 핸들러 타입들.
+	           i번째 핸들러는 i번째 alternative를 받아 bool을 반환해야 한다.
+*/
+template <typename... Handlers>
+class VariantDispatcher{
+public:
+	typedef std::tuple<Handlers...> handlers_t;
+
+	VariantDispatcher(Handlers... _handlers) :
+		handlers( std::move(_handlers)... ){
+	}
+
+	/*
+		operator()
+
+		workItem의 alternative에 맞는 핸들러를 호출한다.
+		valueless_by_exception 상태의 workItem은 처리하지 않고 false를 반환한다.
+	*/
+	template <typename... Alts>
+	bool operator()(const std::variant<Alts...> &workItem){
+		static_assert( sizeof...(Alts) == sizeof...(Handlers),
+			"VariantDispatcher : handler count must match variant alternatives" );
+
+		return dispatch( workItem, std::index_sequence_for<Alts...>() );
+	}
+
+protected:
+	template <size_t I, typename V>
+	static bool invoke(handlers_t &handlers, const V &workItem){
+		return std::get<I>( handlers )( *std::get_if<I>( &workItem ) );
+	}
+
+	template <typename V, size_t... Is>
+	bool dispatch(const V &workItem, std::index_sequence<Is...>){
+		typedef bool (*entry_t)(handlers_t &, const V &);
+
+		static constexpr entry_t table[] = { &invoke<Is, V>... };
+
+		size_t index = workItem.index();
+		if( index >= sizeof...(Is) )
+			return false;
+
+		return table[index]( handlers, workItem );
+	}
+
+protected:
+	handlers_t handlers;
+};
+
+/*
+	makeVariantDispatcher
+
+	핸들러들로부터 VariantDispatcher를 만든다. ( 람다 타입 추론용 )
+*/
+template <typename... Handlers>
+VariantDispatcher<typename std::decay<Handlers>::type...>
+	makeVariantDispatcher(Handlers&&... handlers){
+	return VariantDispatcher<typename std::decay<Handlers>::type...>(
+		std::forward<Handlers>(handlers)... );
+}
+
+/*
+	DynamicVariantPool
+
+	std::variant workItem을 받아 alternative별 핸들러로 처리하는 풀.
+
+		auto dispatcher = makeVariantDispatcher(
+			[](const A &a){ ... return true; },
+			[](const B &b){ ... return true; } );
+		DynamicVariantPool<std::variant<A, B>, decltype(dispatcher)>
+			pool( 4, 16, 1000, dispatcher );
+*/
+template <typename V, typename Dispatcher>
+using DynamicVariantPool = DynamicProcessPool<V, Dispatcher>;
@@ -5,12 +5,20 @@
 
 #include <queue>
 #include <vector>
+#include <memory>
 
 #include <future>
+#include <exception>
 #include <thread>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <optional>
+
+#include "ResultCache.h"
+#include "SingleFlight.h"
+#include "OutputSink.h"
 
 template <typename _IN, typename _OUT>
 class DynamicProcessPool{
@@ -21,6 +29,7 @@ public:
 	typedef struct{
 		std::promise<_OUT> *result;
 		_IN item;
+		uint64_t outputSeq;	// 출력 sink에서의 순서
 	} workPair_t;
 
 	DynamicProcessPool(){
@@ -39,7 +48,8 @@ public:
 		handler( _handler ),
 		quit( false ),
 		maxWorker( _maxWorker ), lifeTime( _lifeTime ),
-		nWorker( 0 ), nWaiting( 0 ), nWorking( 0 ) {
+		nWorker( 0 ), nWaiting( 0 ), nWorking( 0 ),
+		nextOutputSeq( 0 ) {
 
 		for(int i=0;i<_initialWorkers;i++)
 			addWorker( _lifeTime );
@@ -62,9 +72,37 @@ public:
 	*/
 	std::future<_OUT> enqueue(_IN workItem){
 		workPair_t workPair;
+
+		if constexpr( isHashable<_IN>::value ){
+			// 캐시에 결과가 있으면 큐와 worker를 거치지 않고 바로 돌려준다.
+			if( resultCache != nullptr ){
+				std::optional<_OUT> cached = resultCache->find( workItem );
+
+				if( cached ){
+					if( outputSink != nullptr )
+						outputSink->push( nextOutputSeq.fetch_add( 1 ), *cached );
+
+					std::promise<_OUT> ready;
+					ready.set_value( std::move(*cached) );
+					return ready.get_future();
+				}
+			}
+
+			// 같은 workItem이 이미 큐에 있거나 처리 중이면 그 결과를 같이 받는다.
+			if( singleFlight != nullptr ){
+				std::future<_OUT> joined;
+
+				if( !singleFlight->join( workItem, joined ) )
+					return joined;
+			}
+		}
 		
 		workPair.result = new std::promise<_OUT>();
 		workPair.item = workItem;
+		workPair.outputSeq = outputSink != nullptr ? nextOutputSeq.fetch_add( 1 ) : 0;
+
+		// promise는 worker가 처리 후 지우므로 큐에 넣기 전에 future를 받아둔다.
+		std::future<_OUT> future = workPair.result->get_future();
 		
 		// 비어있는 worker가 없고 maxWorker만큼 worker가 없으면
 		// 새 worker를 생성하고 일을 할당.
@@ -81,7 +119,7 @@ public:
 				signal.notify_one();
 		}
 		
-		return workPair.result->get_future();
+		return future;
 	}
 
 	/*
@@ -99,6 +137,58 @@ public:
 			*working = nWorking.load();
 	}
 
+	/*
+		enableResultCache
+
+		handler( item )의 결과를 _IN을 키로 캐시한다.
+		캐시에 있는 workItem은 enqueue에서 바로 완료된 future를 돌려받는다.
+		_IN은 std::hash와 operator==를 지원해야 한다.
+		enqueue를 시작하기 전에 호출해야 한다.
+
+		capacity : 캐시에 담을 결과의 최대 개수
+		ttl : 결과의 유효 시간 ( 0이면 만료되지 않음 )
+		nShard : 락을 나눌 shard의 수
+	*/
+	void enableResultCache(size_t capacity, std::chrono::milliseconds ttl,
+						   int nShard = 16){
+		static_assert( isHashable<_IN>::value,
+			"DynamicProcessPool : result cache requires std::hash<_IN>" );
+
+		resultCache.reset( new ResultCache<_IN, _OUT>( capacity, ttl, nShard ) );
+	}
+
+	/*
+		enableCoalescing
+
+		같은 _IN으로 동시에 들어온 요청들을 하나의 handler 호출로 합친다.
+		먼저 들어온 요청이 큐에 있거나 처리 중인 동안 들어온 요청들은
+		새로 큐에 들어가지 않고 같은 _OUT을 받는다.
+		_IN은 std::hash와 operator==를 지원해야 한다.
+		enqueue를 시작하기 전에 호출해야 한다.
+
+		nShard : 락을 나눌 shard의 수
+	*/
+	void enableCoalescing(int nShard = 16){
+		static_assert( isHashable<_IN>::value,
+			"DynamicProcessPool : coalescing requires std::hash<_IN>" );
+
+		singleFlight.reset( new SingleFlight<_IN, _OUT>( nShard ) );
+	}
+
+	/*
+		setOutputSink
+
+		handler의 결과를 future와 함께 sink에도 넘긴다.
+		worker가 각자 결과를 쓰는 대신 sink가 모아서 writev로 쓴다.
+		sink가 ordered이면 enqueue한 순서대로 쓰이고, 예외로 끝난 workItem은 건너뛴다.
+		캐시에서 바로 돌려준 결과도 쓰이지만, 진행 중인 요청에 합류한 요청은
+		그 요청의 결과 하나로 쓰인다.
+		enqueue를 시작하기 전에 호출해야 한다.
+	*/
+	void setOutputSink(std::shared_ptr<OutputSink<_OUT> > sink){
+		outputSink = sink;
+	}
+
 	/*
 		kill
 
@@ -127,8 +217,39 @@ public:
 
 protected:
 	void doWork(workPair_t &workPair){
-		workPair.result->set_value(
-			handler( workPair.item ) );
+		// _OUT에 기본 생성자나 대입이 없어도 되도록 optional에 바로 만든다.
+		std::optional<_OUT> result;
+
+		try{
+			result.emplace( handler( workPair.item ) );
+		}
+		catch( ... ){
+			std::exception_ptr error = std::current_exception();
+
+			if constexpr( isHashable<_IN>::value ){
+				if( singleFlight != nullptr )
+					singleFlight->fail( workPair.item, error );
+			}
+			if( outputSink != nullptr )
+				outputSink->skip( workPair.outputSeq );
+
+			workPair.result->set_exception( error );
+			delete workPair.result;
+			return;
+		}
+
+		if constexpr( isHashable<_IN>::value ){
+			// 캐시에 먼저 넣어서 합류가 끝난 뒤의 요청은 캐시에서 받게 한다.
+			if( resultCache != nullptr )
+				resultCache->insert( workPair.item, *result );
+			if( singleFlight != nullptr )
+				singleFlight->complete( workPair.item, *result );
+		}
+
+		if( outputSink != nullptr )
+			outputSink->push( workPair.outputSeq, *result );
+
+		workPair.result->set_value( std::move(*result) );
 		delete workPair.result;
 	}
 	
@@ -189,6 +310,7 @@ protected:
 		addWorkerWithWork
 
 		새 worker를 추가하고 workItem을 넣어준다.
+		큐를 거친 workItem과 같이 doWork로 처리하므로 promise가 채워지고 결과가 캐시된다.
 
 		lifeCount : 라이프카운트
 		workItem : 생성과 후 바로 처리할 workItem
@@ -197,8 +319,8 @@ protected:
 		workPair_t workPair = _workPair;
 
 		workers.push_back(
-			std::thread( [=](){
-				handler( workPair.item );
+			std::thread( [=]() mutable{
+				doWork( workPair );
 
 				workthread( lifeCount );
 			}));
@@ -228,10 +350,20 @@ protected:
 
 	const handler_t handler;
 
+	// 결과 캐시 ( 없으면 nullptr )
+	//   shared_ptr는 삭제자를 생성 시점에 고정하므로
+	//   캐시를 쓰지 않는 해시 불가능한 _IN에서도 컴파일된다.
+	std::shared_ptr<ResultCache<_IN, _OUT> > resultCache;
+	// 진행 중인 요청 합류 ( 없으면 nullptr )
+	std::shared_ptr<SingleFlight<_IN, _OUT> > singleFlight;
+	// 결과 출력 sink ( 없으면 nullptr )
+	std::shared_ptr<OutputSink<_OUT> > outputSink;
+	std::atomic<uint64_t> nextOutputSeq;
+
 	int lifeTime;
 	int maxWorker;
 
-	bool quit;	// postQuit 플래그
+	std::atomic<bool> quit;	// postQuit 플래그
 };
 
 #endif //_DYNAMIC_PROCESS_POOL_H